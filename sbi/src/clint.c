@@ -3,6 +3,41 @@
 #include <csr.h>
 
 
+bool clint_has_sstc;
+
+
+// Lets S-mode read time itself, and program its own timer if we have Sstc.
+// Called on every hart, since both CSRs are per hart.
+bool clint_timer_init() {
+    unsigned long envcfg;
+
+    CSR_WRITE("mcounteren", MCOUNTEREN_TM);
+
+    // menvcfg traps if the hart doesn't have it, so point mtvec just past it
+    // for a moment. Harts without Sstc keep STCE hardwired to 0.
+    asm volatile(
+        "la     t0, 1f\n"
+        "csrrw  t1, mtvec, t0\n"
+        "li     %0, 0\n"
+        "csrs   " CSR_MENVCFG ", %1\n"
+        "csrr   %0, " CSR_MENVCFG "\n"
+        ".align 2\n"
+        "1:\n"
+        "csrw   mtvec, t1\n"
+        : "=&r"(envcfg)
+        : "r"(MENVCFG_STCE)
+        : "t0", "t1", "memory"
+    );
+
+    clint_has_sstc = (envcfg & MENVCFG_STCE) != 0;
+    if (clint_has_sstc) {
+        CSR_WRITE(CSR_STIMECMP, CLINT_TIME_INFINITE);
+    }
+
+    return clint_has_sstc;
+}
+
+
 void clint_set_msip(int hart) {
     if (!IS_VALID_HART(hart)) {
         return;
@@ -44,6 +79,12 @@ void clint_handle_mtip() {
     
     clint_set_timer(hart, CLINT_TIME_INFINITE);
 
+    // STIP follows stimecmp with Sstc on, so fire it through that instead
+    if (clint_has_sstc) {
+        CSR_WRITE(CSR_STIMECMP, 0UL);
+        return;
+    }
+
     CSR_READ(mip, "mip");
     mip &= ~MIP_MTIP;
     CSR_WRITE("mip", mip | SIP_STIP);
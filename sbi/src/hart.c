@@ -75,7 +75,29 @@ bool hart_stop(int hart) {
     return false;
 }
 
+// Wakes a started hart with a supervisor software interrupt
+bool hart_send_ipi(int hart) {
+    if (!IS_VALID_HART(hart)) {
+        return false;
+    }
+
+    mutex_sbi_lock(&sbi_hart_data[hart].lock);
+
+    if (sbi_hart_data[hart].status != HS_STARTED) {
+        mutex_unlock(&sbi_hart_data[hart].lock);
+        return false;
+    }
+
+    sbi_hart_data[hart].ipi_pending = true;
+    clint_set_msip(hart);
+
+    mutex_unlock(&sbi_hart_data[hart].lock);
+    return true;
+}
+
 void hart_handle_msip(int hart) {
+    unsigned long mip;
+
     if (!IS_VALID_HART(hart)) {
         return;
     }
@@ -84,6 +106,16 @@ void hart_handle_msip(int hart) {
 
     clint_unset_msip(hart);
 
+    // Forward IPIs to S-mode as SSIP
+    if (sbi_hart_data[hart].ipi_pending) {
+        sbi_hart_data[hart].ipi_pending = false;
+
+        if (sbi_hart_data[hart].status == HS_STARTED) {
+            CSR_READ(mip, "mip");
+            CSR_WRITE("mip", mip | SIP_SSIP);
+        }
+    }
+
     if (sbi_hart_data[hart].status != HS_STARTING) {
         mutex_unlock(&sbi_hart_data[hart].lock);
         return;
@@ -1,6 +1,9 @@
 #pragma once
 
 
+#include <stdbool.h>
+
+
 #define CLINT_BASE      (0x2000000UL)
 #define CLINT_BASE_PTR  ((volatile unsigned int*) CLINT_BASE)
 
@@ -10,6 +13,11 @@
 #define CLINT_TIME_INFINITE 0x000fffffffffffffUL
 
 
+extern bool clint_has_sstc;
+
+
+bool clint_timer_init();
+
 void clint_set_msip(int hart);
 void clint_unset_msip(int hart);
 
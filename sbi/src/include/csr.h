@@ -26,10 +26,16 @@
 #define MSTATUS_MPP_SUPERVISOR    (1UL << MSTATUS_MPP_BIT)
 #define MSTATUS_MPP_USER          (0UL << MSTATUS_MPP_BIT)
 
+#define SSTATUS_SIE_BIT           1
+#define SSTATUS_SIE               (1UL << SSTATUS_SIE_BIT)
+
 #define SSTATUS_SPP_BIT           8
 #define SSTATUS_SPP_SUPERVISOR    (1UL << SSTATUS_SPP_BIT)
 #define SSTATUS_SPP_USER          (0UL << SSTATUS_SPP_BIT)
 
+#define SSTATUS_SUM_BIT           18
+#define SSTATUS_SUM               (1UL << SSTATUS_SUM_BIT)
+
 #define MSTATUS_MPIE_BIT          7
 #define MSTATUS_MPIE              (1UL << MSTATUS_MPIE_BIT)
 
@@ -98,6 +104,16 @@
 
 #define MEDELEG_ALL               (0xB1F7UL)
 
+#define MCOUNTEREN_TM_BIT         1
+#define MCOUNTEREN_TM             (1UL << MCOUNTEREN_TM_BIT)
+
+#define MENVCFG_STCE_BIT          63
+#define MENVCFG_STCE              (1UL << MENVCFG_STCE_BIT)
+
+// Not every assembler knows these by name yet
+#define CSR_MENVCFG               "0x30a"
+#define CSR_STIMECMP              "0x14d"
+
 #define XREG_ZERO                 (0)
 #define XREG_RA                   (1)
 #define XREG_SP                   (2)
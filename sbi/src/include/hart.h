@@ -31,6 +31,7 @@ typedef struct HartData {
     HartStatus status;
     uint64_t target_address;
     uint64_t scratch;
+    bool ipi_pending;
 } HartData;
 
 
@@ -40,4 +41,5 @@ extern HartData sbi_hart_data[NUM_HARTS];
 HartStatus get_hart_status(int hart);
 bool hart_start(int hart, uint64_t target, uint64_t scratch);
 bool hart_stop(int hart);
+bool hart_send_ipi(int hart);
 void hart_handle_msip(int hart);
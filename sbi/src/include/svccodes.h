@@ -2,6 +2,7 @@
 
 #define SBI_PUTCHAR (10)
 #define SBI_GETCHAR (11)
+#define SBI_PUTSTRING (12)
 
 #define SBI_GET_HART_STATUS (20)
 #define SBI_HART_START      (21)
@@ -11,5 +12,10 @@
 #define SBI_SET_TIMER       (25)
 #define SBI_ADD_TIMER       (26)
 #define SBI_ACK_TIMER       (27)
+#define SBI_SEND_IPI        (28)
+#define SBI_GET_FEATURES    (29)
 
 #define SBI_POWEROFF (30)
+
+// Bits returned by SBI_GET_FEATURES
+#define SBI_FEATURE_SSTC    (1UL << 0)  // S-mode can program its own timer with stimecmp
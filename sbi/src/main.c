@@ -3,6 +3,7 @@
 #include <uart.h>
 #include <printf.h>
 #include <plic.h>
+#include <clint.h>
 #include <csr.h>
 #include <lock.h>
 #include <hart.h>
@@ -47,6 +48,7 @@ int main(int hartid) {
         }
 
         pmp_init();
+        clint_timer_init();
 
         sbi_hart_data[hartid].status = HS_STARTED;
         sbi_hart_data[hartid].scratch = HPM_MACHINE;
@@ -72,6 +74,7 @@ int main(int hartid) {
     // Initialize other hart statuses, interrupt settings, and then wait until needed
 
     pmp_init();
+    clint_timer_init();
 
     sbi_hart_data[hartid].status = HS_STOPPED;
     sbi_hart_data[hartid].scratch = HPM_MACHINE;
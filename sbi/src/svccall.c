@@ -24,6 +24,10 @@ void svccall_handle(int hart) {
             uart_put(c);
             break;
     
+        case SBI_PUTSTRING:
+            // Only ever handled in sbi_trap_vector, since the buffer needs MPRV
+            break;
+
         case SBI_GETCHAR:
             mscratch[XREG_A0] = uart_get_buffered();    // Set return value
             break;
@@ -67,11 +71,23 @@ void svccall_handle(int hart) {
             break;
 
         case SBI_ACK_TIMER:
+            if (clint_has_sstc) {
+                CSR_WRITE(CSR_STIMECMP, CLINT_TIME_INFINITE);
+            }
+
             CSR_READ(sip, "mip");
             clint_set_timer(hart, CLINT_TIME_INFINITE);
             CSR_WRITE("mip", sip & ~SIP_STIP);
             break;
 
+        case SBI_SEND_IPI:
+            mscratch[XREG_A0] = hart_send_ipi(mscratch[XREG_A0]);
+            break;
+
+        case SBI_GET_FEATURES:
+            mscratch[XREG_A0] = clint_has_sstc ? SBI_FEATURE_SSTC : 0;
+            break;
+
         case SBI_POWEROFF:
             *((volatile unsigned short*) 0x100000) = 0x5555;
             break;
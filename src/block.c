@@ -15,13 +15,26 @@ List* virtio_block_devices;
 
 bool virtio_block_driver(volatile EcamHeader* ecam) {
     VirtioDevice* device;
+    VirtioBlockDeviceInfo* info;
     bool rv;
+    u16 i;
 
     device = kzalloc(sizeof(VirtioDevice));
     
     rv = virtio_device_driver(device, ecam);
 
     device->request_info = kzalloc(sizeof(void*) * device->cfg->queue_size);
+
+    // Every descriptor starts out free
+    info = kzalloc(sizeof(VirtioBlockDeviceInfo));
+    for (i = 0; i < device->cfg->queue_size; i++) {
+        device->queue_desc[i].next = i + 1;
+    }
+
+    info->free_head = 0;
+    info->num_free = device->cfg->queue_size;
+    device->device_info = info;
+
     device->handle_irq = block_handle_irq;
     device->enabled = true;
     if (virtio_block_devices == NULL) {
@@ -35,89 +48,325 @@ bool virtio_block_driver(volatile EcamHeader* ecam) {
 }
 
 
+void _block_completion_put(BlockCompletion* completion) {
+    u32 pending;
+
+    asm volatile("amoadd.w %0, %1, (%2)" : "=r"(pending) : "r"(-1), "r"(&completion->pending));
+
+    if (pending == 1) {
+        completion->callback(completion);
+    }
+}
+
+// Everything that happens to a request after the device is done with it:
+// copy read data out, free all of it, and let its completion know. Polled
+// requests do this on the hart that's waiting for them, and everything else
+// does it in a worker. Returns false if the device failed the request.
+bool _block_finish(VirtioBlockRequestInfo* req_info) {
+    VirtioBlockDescHeader* desc_header;
+    VirtioBlockDescStatus* desc_status;
+    BlockCompletion* completion;
+    bool ok;
+
+    desc_header = req_info->desc_header;
+    desc_status = req_info->desc_status;
+    completion = req_info->completion;
+
+    ok = desc_status->status == VIRTIO_BLK_S_OK;
+    if (!ok) {
+        printf("_block_finish: block: non-OK status: %d, sector: %ld\n", desc_status->status, desc_header->sector);
+    } else if (desc_header->type == VIRTIO_BLK_T_IN && !req_info->in_place) {  // If read request
+        // Copy exact chunk needed from buffer to dst
+        memcpy(req_info->dst, req_info->data + req_info->offset, req_info->size);
+    } else if (desc_header->type == VIRTIO_BLK_T_IN) {
+        // Whole sectors went straight into dst. Only the partial ones need copying.
+        if (req_info->head_size != 0) {
+            memcpy(req_info->dst, req_info->data + req_info->offset, req_info->head_size);
+        }
+
+        if (req_info->tail_size != 0) {
+            memcpy(req_info->dst + req_info->size - req_info->tail_size, req_info->data + req_info->tail_offset, req_info->tail_size);
+        }
+    }
+
+    if (req_info->data != NULL) {
+        page_dealloc(req_info->data);
+    }
+
+    kfree(desc_header);
+    kfree(desc_status);
+    kfree((void*) req_info);
+
+    if (completion != NULL) {
+        if (!ok) {
+            completion->failed = true;
+        }
+
+        if (completion->callback != NULL) {
+            _block_completion_put(completion);
+        }
+    }
+
+    return ok;
+}
+
+void _block_complete(void* data) {
+    _block_finish(data);
+}
+
+// Only takes requests off the used ring and frees their descriptors.
+// Anything slow waits until after the interrupt.
 void block_handle_irq(VirtioDevice* block_device) {
+    VirtioBlockDeviceInfo* info;
     u16 ack_idx;
     u16 queue_size;
+    u16 flags;
     u32 id;
+    u32 idx;
+    u32 next_idx;
     VirtioBlockRequestInfo* req_info;
-    VirtioBlockDescHeader* desc_header;
-    VirtioBlockDescStatus* desc_status;
-    volatile VirtioBlockDeviceCapability* device_cfg;
 
+    info = block_device->device_info;
     queue_size = block_device->cfg->queue_size;
 
+    mutex_sbi_lock(&block_device->lock);
+
     while (block_device->ack_idx != block_device->queue_device->idx) {
         ack_idx = block_device->ack_idx;
 
         id = block_device->queue_device->ring[ack_idx % queue_size].id % queue_size;
     
         req_info = block_device->request_info[id];
-        desc_header = req_info->desc_header;
-        desc_status = req_info->desc_status;
 
-        if (desc_status->status != VIRTIO_BLK_S_OK) {
-            printf("block_handle_irq: block: non-OK status: %d, idx: %d\n", desc_status->status, id);
-        } else if (desc_header->type == VIRTIO_BLK_T_IN) {  // If read request
-            // Copy exact chunk needed from buffer to dst
-            device_cfg = block_device->device_cfg;
+        block_device->ack_idx++;
 
-            memcpy(req_info->dst, req_info->data + ((u64) req_info->src % device_cfg->blk_size), req_info->size);
+        // Give the chain back
+        idx = id;
+        do {
+            flags = block_device->queue_desc[idx].flags;
+            next_idx = block_device->queue_desc[idx].next;
+
+            block_device->queue_desc[idx].next = info->free_head;
+            info->free_head = idx;
+            info->num_free++;
+
+            idx = next_idx;
+        } while (flags & VIRT_QUEUE_DESC_FLAG_NEXT);
+
+        if (req_info->poll) {
+            // The poller reads the data right after seeing this
+            asm volatile("fence rw, w" ::: "memory");
+            req_info->complete = true;
+        } else {
+            workqueue_queue((Work*) &req_info->work);
         }
+    }
 
-        req_info->complete = true;
+    mutex_unlock(&block_device->lock);
+};
 
-        switch (desc_header->type) {
-            case VIRTIO_BLK_T_IN:
-            case VIRTIO_BLK_T_OUT:
-                page_dealloc(req_info->data);
-                if (!req_info->poll) {
-                    kfree((void*) req_info);
-                }
-        }                
 
-        kfree(desc_header);
-        kfree(desc_status);
+// Takes a descriptor off the free list. Needs the device lock and a free descriptor.
+u16 _block_desc_alloc(VirtioDevice* block_device) {
+    VirtioBlockDeviceInfo* info;
+    u16 idx;
 
-        block_device->ack_idx++;
+    info = block_device->device_info;
+
+    idx = info->free_head;
+    info->free_head = block_device->queue_desc[idx].next;
+    info->num_free--;
+
+    return idx;
+}
+
+// Splits [buf, buf + size) into physically contiguous pieces the device can
+// DMA straight into. Returns how many it took, or 0 if some of it isn't
+// mapped or it would take more than max.
+u32 _block_segments(void* buf, u32 size, BlockSegment* segs, u32 max) {
+    u64 vaddr;
+    u64 end;
+    u64 paddr;
+    u64 len;
+    u32 n;
+
+    vaddr = (u64) buf;
+    end = vaddr + size;
+    n = 0;
+
+    while (vaddr < end) {
+        paddr = mmu_translate(kernel_mmu_table, vaddr);
+        if (paddr == -1UL) {
+            return 0;
+        }
+
+        len = PS_4K - vaddr % PS_4K;
+        if (len > end - vaddr) {
+            len = end - vaddr;
+        }
+
+        if (n > 0 && segs[n - 1].addr + segs[n - 1].len == paddr) {
+            segs[n - 1].len += len;
+        } else {
+            if (n == max) {
+                return 0;
+            }
+
+            segs[n].addr = paddr;
+            segs[n].len = len;
+            n++;
+        }
+
+        vaddr += len;
     }
-};
 
+    return n;
+}
 
-bool block_request(VirtioDevice* block_device, uint16_t type, void* dst, void* src, uint32_t size, bool lock, bool poll) {
-    u32 at_idx;
-    u32 first_idx;
-    u32 next_idx;
+// Like _block_segments, but for len bytes starting offset bytes into what iov describes
+u32 _block_iov_segments(BlockIovec* iov, u32 iovcnt, u64 offset, u64 len, BlockSegment* segs, u32 max) {
+    u64 piece;
+    u32 n;
+    u32 added;
+    u32 i;
+
+    n = 0;
+    for (i = 0; i < iovcnt && len != 0; i++) {
+        if (offset >= iov[i].len) {
+            offset -= iov[i].len;
+            continue;
+        }
+
+        piece = iov[i].len - offset;
+        if (piece > len) {
+            piece = len;
+        }
+
+        added = _block_segments(iov[i].base + offset, piece, segs + n, max - n);
+        if (added == 0) {
+            return 0;
+        }
+
+        n += added;
+        len -= piece;
+        offset = 0;
+    }
+
+    return n;
+}
+
+// Copies len bytes starting offset bytes into what iov describes to dst
+void _block_iov_copy(void* dst, BlockIovec* iov, u32 iovcnt, u64 offset, u64 len) {
+    u64 piece;
+    u32 i;
+
+    for (i = 0; i < iovcnt && len != 0; i++) {
+        if (offset >= iov[i].len) {
+            offset -= iov[i].len;
+            continue;
+        }
+
+        piece = iov[i].len - offset;
+        if (piece > len) {
+            piece = len;
+        }
+
+        memcpy(dst, iov[i].base + offset, piece);
+
+        dst += piece;
+        len -= piece;
+        offset = 0;
+    }
+}
+
+// Reads the sectors a write only partly covers, so the rest of them survive it.
+// Both reads are in flight at once. Has to happen before taking the device lock.
+bool _block_read_partial(VirtioDevice* block_device, u8* first, u32 first_sector, u8* last, u32 last_sector) {
+    BlockCompletion completion;
+    u32 blk_size;
+
+    blk_size = ((volatile VirtioBlockDeviceCapability*) block_device->device_cfg)->blk_size;
+
+    block_completion_init(&completion, NULL, NULL);
+
+    if (first != NULL) {
+        block_submit(block_device, VIRTIO_BLK_T_IN, first, (void*) ((u64) first_sector * blk_size), blk_size, &completion);
+    }
+
+    if (last != NULL) {
+        block_submit(block_device, VIRTIO_BLK_T_IN, last, (void*) ((u64) last_sector * blk_size), blk_size, &completion);
+    }
+
+    return block_wait(&completion);
+}
+
+// Puts a request on the queue and returns without waiting for it. Polled
+// requests are left for the caller to finish with _block_finish once
+// they're complete, everything else finishes in a worker.
+//
+// Whole sectors go straight between the device and dst (or src, or iov for
+// a vectored write), one descriptor per physical piece. Only a partial first
+// or last sector goes through a bounce buffer. Anything else is bounced
+// whole. Writes only read back the sectors they partly cover.
+VirtioBlockRequestInfo* _block_submit(VirtioDevice* block_device, uint16_t type, void* dst, void* src, uint32_t size, BlockIovec* iov, uint32_t iovcnt, bool poll, BlockCompletion* completion) {
+    u32 header_idx;
+    u32 status_idx;
+    u32 idx;
+    u32 prev_idx;
+    u32 num_segs;
+    u32 num_desc;
     u32 queue_size;
+    u32 i;
     u32* notify_ptr;
+    u64 sstatus;
     VirtioBlockDescHeader* desc_header;
-    VirtioBlockDescData* desc_data;
     VirtioBlockDescStatus* desc_status;
     volatile VirtioBlockDeviceCapability* cfg;
+    VirtioBlockDeviceInfo* info;
+    u32 blk_size;
     u32 low_sector;
     u32 high_sector;
     u32 aligned_size;
+    u32 head_size;
+    u32 tail_size;
+    u32 middle_size;
+    bool in_place;
     u8* data;
+    BlockSegment* segs;
+    BlockIovec single;
     VirtioBlockRequestInfo* request_info;
 
     if (!block_device->enabled) {
-        printf("block_request: block device not enabled\n");
-        return false;
+        printf("_block_submit: block device not enabled\n");
+        return NULL;
     }
 
-    if (lock) {
-        mutex_sbi_lock(&block_device->lock);
+    // Writes all work on an iovec. A plain one is just the one buffer.
+    if (type == VIRTIO_BLK_T_OUT && iov == NULL) {
+        single.base = src;
+        single.len = size;
+        iov = &single;
+        iovcnt = 1;
+    } else if (iov != NULL) {
+        size = 0;
+        for (i = 0; i < iovcnt; i++) {
+            size += iov[i].len;
+        }
     }
 
     cfg = block_device->device_cfg;
+    info = block_device->device_info;
+    queue_size = block_device->cfg->queue_size;
+    blk_size = cfg->blk_size;
 
     if (type == VIRTIO_BLK_T_IN) {
-        low_sector = (u64) src / cfg->blk_size;
-        high_sector = ((u64) src + size + cfg->blk_size - 1) / cfg->blk_size;
-        aligned_size = (high_sector - low_sector) * cfg->blk_size;
+        low_sector = (u64) src / blk_size;
+        high_sector = ((u64) src + size + blk_size - 1) / blk_size;
+        aligned_size = (high_sector - low_sector) * blk_size;
     } else { // if (type == VIRTIO_BLK_T_OUT)
-        low_sector = (u64) dst / cfg->blk_size;
-        high_sector = ((u64) dst + size + cfg->blk_size - 1) / cfg->blk_size;
-        aligned_size = (high_sector - low_sector) * cfg->blk_size;
+        low_sector = (u64) dst / blk_size;
+        high_sector = ((u64) dst + size + blk_size - 1) / blk_size;
+        aligned_size = (high_sector - low_sector) * blk_size;
     }
 
     // Initialize descriptors
@@ -126,91 +375,235 @@ bool block_request(VirtioDevice* block_device, uint16_t type, void* dst, void* s
     desc_header->sector = low_sector;
 
     data = NULL;
-    desc_data = NULL;
-
-    // If read or write
-    if (type == VIRTIO_BLK_T_IN || type == VIRTIO_BLK_T_OUT) {
-        // Read data goes here first.
-        // In the driver, the needed chunk gets copied from here to dst.
-        data = page_alloc((aligned_size + PS_4K - 1) / PS_4K);
-
-        // If write, first fill data array with data from file
-        // so that chunks of the first and last written sector aren't zeroed out.
-        if (type == VIRTIO_BLK_T_OUT) {
-            // I could just do two read requests for first and last sector,
-            // but that's more complicated.
-
-            // Don't lock because this should count as part of the same request.
-            if (!block_request(block_device, VIRTIO_BLK_T_IN, data, (void*) ((u64) low_sector * cfg->blk_size), aligned_size, false, true)) {
-                printf("block_request: block_read failed\n");
+    segs = NULL;
+    num_segs = 0;
+    head_size = 0;
+    tail_size = 0;
+    in_place = false;
+
+    if (type == VIRTIO_BLK_T_IN) {
+        // Bytes of dst that come from a partial first sector, whole sectors, and a partial last sector
+        head_size = (u64) src % blk_size != 0 || size < blk_size ? blk_size - (u64) src % blk_size : 0;
+        if (head_size > size) {
+            head_size = size;
+        }
+
+        middle_size = (size - head_size) / blk_size * blk_size;
+        tail_size = size - head_size - middle_size;
+
+        segs = kmalloc(sizeof(BlockSegment) * (BLOCK_MAX_SEGMENTS + 2));
+
+        if (middle_size != 0) {
+            if (head_size != 0) {
+                num_segs++;
+            }
+
+            i = _block_segments(dst + head_size, middle_size, segs + num_segs, BLOCK_MAX_SEGMENTS);
+            if (i == 0) {
+                num_segs = 0;
+            } else {
+                num_segs += i;
             }
+        }
+
+        if (num_segs != 0) {
+            in_place = true;
+
+            // Both partial sectors share one bounce buffer. The first goes at the start, the last right after.
+            if (head_size != 0 || tail_size != 0) {
+                data = page_alloc((2 * blk_size + PS_4K - 1) / PS_4K);
+
+                if (head_size != 0) {
+                    segs[0].addr = mmu_translate(kernel_mmu_table, (u64) data);
+                    segs[0].len = blk_size;
+                }
 
-            memcpy(data + (u64) dst % cfg->blk_size, src, size);
+                if (tail_size != 0) {
+                    segs[num_segs].addr = mmu_translate(kernel_mmu_table, (u64) data + blk_size);
+                    segs[num_segs].len = blk_size;
+                    num_segs++;
+                }
+            }
+        } else {
+            // Nothing to read in place, so bounce all of it
+            head_size = 0;
+            tail_size = 0;
+            data = page_alloc((aligned_size + PS_4K - 1) / PS_4K);
+
+            segs[0].addr = mmu_translate(kernel_mmu_table, (u64) data);
+            segs[0].len = aligned_size;
+            num_segs = 1;
+        }
+    } else if (type == VIRTIO_BLK_T_OUT) {
+        head_size = (u64) dst % blk_size != 0 || size < blk_size ? blk_size - (u64) dst % blk_size : 0;
+        if (head_size > size) {
+            head_size = size;
         }
 
-        desc_data = (u8*) data;
+        middle_size = (size - head_size) / blk_size * blk_size;
+        tail_size = size - head_size - middle_size;
+
+        segs = kmalloc(sizeof(BlockSegment) * (BLOCK_MAX_SEGMENTS + 2));
+
+        // The device reads src while the request's in flight, so it's only
+        // used in place when somebody is going to wait for the request
+        if (middle_size != 0 && (poll || completion != NULL)) {
+            if (head_size != 0) {
+                num_segs++;
+            }
+
+            i = _block_iov_segments(iov, iovcnt, head_size, middle_size, segs + num_segs, BLOCK_MAX_SEGMENTS);
+            if (i == 0) {
+                num_segs = 0;
+            } else {
+                num_segs += i;
+            }
+        }
+
+        if (num_segs != 0) {
+            in_place = true;
+
+            // Same bounce buffer layout as reads
+            if (head_size != 0 || tail_size != 0) {
+                data = page_alloc((2 * blk_size + PS_4K - 1) / PS_4K);
+
+                if (
+                    !_block_read_partial(
+                        block_device,
+                        head_size != 0 ? data : NULL,
+                        low_sector,
+                        tail_size != 0 ? data + blk_size : NULL,
+                        high_sector - 1
+                    )
+                ) {
+                    printf("_block_submit: _block_read_partial failed\n");
+                }
+
+                if (head_size != 0) {
+                    _block_iov_copy(data + (u64) dst % blk_size, iov, iovcnt, 0, head_size);
+
+                    segs[0].addr = mmu_translate(kernel_mmu_table, (u64) data);
+                    segs[0].len = blk_size;
+                }
+
+                if (tail_size != 0) {
+                    _block_iov_copy(data + blk_size, iov, iovcnt, size - tail_size, tail_size);
+
+                    segs[num_segs].addr = mmu_translate(kernel_mmu_table, (u64) data + blk_size);
+                    segs[num_segs].len = blk_size;
+                    num_segs++;
+                }
+            }
+        } else {
+            // Copy all of it. Only the first and last sector can be partial,
+            // so those are the only ones that need reading first.
+            data = page_alloc((aligned_size + PS_4K - 1) / PS_4K);
+
+            if (
+                (head_size != 0 || tail_size != 0) &&
+                !_block_read_partial(
+                    block_device,
+                    head_size != 0 ? data : NULL,
+                    low_sector,
+                    tail_size != 0 && high_sector - 1 != low_sector ? data + aligned_size - blk_size : NULL,
+                    high_sector - 1
+                )
+            ) {
+                printf("_block_submit: _block_read_partial failed\n");
+            }
+
+            _block_iov_copy(data + (u64) dst % blk_size, iov, iovcnt, 0, size);
+
+            head_size = 0;
+            tail_size = 0;
+
+            segs[0].addr = mmu_translate(kernel_mmu_table, (u64) data);
+            segs[0].len = aligned_size;
+            num_segs = 1;
+        }
     }
 
     desc_status = kzalloc(sizeof(VirtioBlockDescStatus));
     desc_status->status = VIRTIO_BLK_S_INCOMP;
 
-    at_idx = block_device->at_idx;
-    first_idx = at_idx;
-    queue_size = block_device->cfg->queue_size;
+    // Request info for later use in driver
+    request_info = kzalloc(sizeof(VirtioBlockRequestInfo));
+    request_info->dst = dst;
+    request_info->src = src;
+    request_info->data = data;
+    request_info->size = size;
+    request_info->offset = (u64) src % blk_size;
+    request_info->head_size = head_size;
+    request_info->tail_size = tail_size;
+    request_info->tail_offset = blk_size;
+    request_info->in_place = in_place;
+    request_info->desc_header = desc_header;
+    request_info->desc_data = data;
+    request_info->desc_status = desc_status;
+    request_info->poll = poll;
+    request_info->complete = false;
+    request_info->completion = completion;
+    request_info->next = NULL;
+    work_prepare((Work*) &request_info->work, _block_complete, (void*) request_info);
+
+    num_desc = num_segs + 2;
+
+    // block_handle_irq takes the lock too, so interrupts stay off while we hold it
+    while (true) {
+        asm volatile("csrrc %0, sstatus, %1" : "=r"(sstatus) : "r"(SSTATUS_SIE));
+        mutex_sbi_lock(&block_device->lock);
+
+        if (info->num_free >= num_desc) {
+            break;
+        }
+
+        // Every descriptor's in flight. Wait for the device to finish something.
+        mutex_unlock(&block_device->lock);
+        asm volatile("csrs sstatus, %0" :: "r"(sstatus & SSTATUS_SIE));
+
+        while (info->num_free < num_desc) {
+            // WFI();
+        }
+    }
 
     // Add descriptors to queue
-    // DESCRIPTOR 1
-    block_device->queue_desc[at_idx].addr = mmu_translate(kernel_mmu_table, (u64) desc_header);
-    block_device->queue_desc[at_idx].len = sizeof(VirtioBlockDescHeader);
-    block_device->queue_desc[at_idx].flags = VIRT_QUEUE_DESC_FLAG_NEXT;
-
-    // Increment at_idx and set next to the incremented at_idx
-    next_idx = (at_idx + 1) % queue_size;
-    block_device->queue_desc[at_idx].next = next_idx;
-    at_idx = next_idx;
-
-    if (type == VIRTIO_BLK_T_IN || type == VIRTIO_BLK_T_OUT) {
-        // DESCRIPTOR 2
-        block_device->queue_desc[at_idx].addr = mmu_translate(kernel_mmu_table, (u64) desc_data);
-        block_device->queue_desc[at_idx].len = aligned_size;
-        block_device->queue_desc[at_idx].flags = VIRT_QUEUE_DESC_FLAG_NEXT;
+    // Header
+    header_idx = _block_desc_alloc(block_device);
+    block_device->queue_desc[header_idx].addr = mmu_translate(kernel_mmu_table, (u64) desc_header);
+    block_device->queue_desc[header_idx].len = sizeof(VirtioBlockDescHeader);
+    block_device->queue_desc[header_idx].flags = VIRT_QUEUE_DESC_FLAG_NEXT;
+
+    // Data, one per segment
+    prev_idx = header_idx;
+    for (i = 0; i < num_segs; i++) {
+        idx = _block_desc_alloc(block_device);
+        block_device->queue_desc[prev_idx].next = idx;
+
+        block_device->queue_desc[idx].addr = segs[i].addr;
+        block_device->queue_desc[idx].len = segs[i].len;
+        block_device->queue_desc[idx].flags = VIRT_QUEUE_DESC_FLAG_NEXT;
         if (type == VIRTIO_BLK_T_IN) {
-            block_device->queue_desc[at_idx].flags |= VIRT_QUEUE_DESC_FLAG_WRITE;
+            block_device->queue_desc[idx].flags |= VIRT_QUEUE_DESC_FLAG_WRITE;
         }
 
-        next_idx = (at_idx + 1) % queue_size;
-        block_device->queue_desc[at_idx].next = next_idx;
-        at_idx = next_idx;
+        prev_idx = idx;
     }
 
-    // DESCRIPTOR 3
-    block_device->queue_desc[at_idx].addr = mmu_translate(kernel_mmu_table, (u64) desc_status);
-    block_device->queue_desc[at_idx].len = sizeof(VirtioBlockDescStatus);
-    block_device->queue_desc[at_idx].flags = VIRT_QUEUE_DESC_FLAG_WRITE;
-    block_device->queue_desc[at_idx].next = 0;
+    // Status
+    status_idx = _block_desc_alloc(block_device);
+    block_device->queue_desc[prev_idx].next = status_idx;
+    block_device->queue_desc[status_idx].addr = mmu_translate(kernel_mmu_table, (u64) desc_status);
+    block_device->queue_desc[status_idx].len = sizeof(VirtioBlockDescStatus);
+    block_device->queue_desc[status_idx].flags = VIRT_QUEUE_DESC_FLAG_WRITE;
+    block_device->queue_desc[status_idx].next = 0;
 
-    // Add descriptor to driver ring
-    block_device->queue_driver->ring[block_device->queue_driver->idx % queue_size] = first_idx;
-
-    if (type == VIRTIO_BLK_T_IN || type == VIRTIO_BLK_T_OUT) {
-        // Add request info for later use in driver
-        request_info = kzalloc(sizeof(VirtioBlockRequestInfo));
-        request_info->dst = dst;
-        request_info->src = src;
-        request_info->data = data;
-        request_info->size = size;
-        request_info->desc_header = desc_header;
-        request_info->desc_data = desc_data;
-        request_info->desc_status = desc_status;
-        request_info->poll = poll;
-        request_info->complete = false;
-        block_device->request_info[first_idx] = (void*) request_info;
-    }
+    block_device->request_info[header_idx] = (void*) request_info;
 
-    // Increment indices
-    at_idx = (at_idx + 1) % queue_size;
-    block_device->at_idx = at_idx;
+    // Add descriptor to driver ring
+    block_device->queue_driver->ring[block_device->queue_driver->idx % queue_size] = header_idx;
 
+    // The device can't see the new entry before the descriptors it points at
+    asm volatile("fence w, w" ::: "memory");
     block_device->queue_driver->idx += 1;
 
     // Notify
@@ -222,43 +615,140 @@ bool block_request(VirtioDevice* block_device, uint16_t type, void* dst, void* s
     
     *notify_ptr = 0;
 
-    if (lock) {
-        mutex_unlock(&block_device->lock);
+    mutex_unlock(&block_device->lock);
+    asm volatile("csrs sstatus, %0" :: "r"(sstatus & SSTATUS_SIE));
+
+    if (segs != NULL) {
+        kfree(segs);
     }
 
-    if (poll) {
-        if (type == VIRTIO_BLK_T_IN || type == VIRTIO_BLK_T_OUT) {
-            while (!request_info->complete) {
-                // WFI();
-            }
+    return request_info;
+}
 
-            kfree((void*) request_info);
-        }
+bool block_request(VirtioDevice* block_device, uint16_t type, void* dst, void* src, uint32_t size, BlockIovec* iov, uint32_t iovcnt, bool poll) {
+    VirtioBlockRequestInfo* request_info;
+
+    request_info = _block_submit(block_device, type, dst, src, size, iov, iovcnt, poll, NULL);
+    if (request_info == NULL) {
+        return false;
     }
 
-    return true;
+    if (!poll) {
+        return true;
+    }
+
+    while (!request_info->complete) {
+        // WFI();
+    }
+
+    asm volatile("fence r, rw" ::: "memory");
+    return _block_finish(request_info);
 }
 
 bool block_read(VirtioDevice* block_Device, void* dst, void* src, uint32_t size) {
-    return block_request(block_Device, VIRTIO_BLK_T_IN, dst, src, size, true, false);
+    return block_request(block_Device, VIRTIO_BLK_T_IN, dst, src, size, NULL, 0, false);
 }
 
 bool block_write(VirtioDevice* block_Device, void* dst, void* src, uint32_t size) {
-    return block_request(block_Device, VIRTIO_BLK_T_OUT, dst, src, size, true, false);
+    return block_request(block_Device, VIRTIO_BLK_T_OUT, dst, src, size, NULL, 0, false);
 }
 
 bool block_flush(VirtioDevice* block_Device, void* addr) {
-    return block_request(block_Device, VIRTIO_BLK_T_FLUSH, addr, NULL, 0, true, false);
+    return block_request(block_Device, VIRTIO_BLK_T_FLUSH, addr, NULL, 0, NULL, 0, false);
 }
 
 bool block_read_poll(VirtioDevice* block_Device, void* dst, void* src, uint32_t size) {
-    return block_request(block_Device, VIRTIO_BLK_T_IN, dst, src, size, true, true);
+    return block_request(block_Device, VIRTIO_BLK_T_IN, dst, src, size, NULL, 0, true);
 }
 
 bool block_write_poll(VirtioDevice* block_Device, void* dst, void* src, uint32_t size) {
-    return block_request(block_Device, VIRTIO_BLK_T_OUT, dst, src, size, true, true);
+    return block_request(block_Device, VIRTIO_BLK_T_OUT, dst, src, size, NULL, 0, true);
 }
 
 bool block_flush_poll(VirtioDevice* block_Device, void* addr) {
-    return block_request(block_Device, VIRTIO_BLK_T_FLUSH, addr, NULL, 0, true, true);
+    return block_request(block_Device, VIRTIO_BLK_T_FLUSH, addr, NULL, 0, NULL, 0, true);
+}
+
+// Writes every buffer in iov, one after the other, starting at byte dst of the disk
+bool block_writev(VirtioDevice* block_Device, void* dst, BlockIovec* iov, uint32_t iovcnt) {
+    return block_request(block_Device, VIRTIO_BLK_T_OUT, dst, NULL, 0, iov, iovcnt, false);
+}
+
+bool block_writev_poll(VirtioDevice* block_Device, void* dst, BlockIovec* iov, uint32_t iovcnt) {
+    return block_request(block_Device, VIRTIO_BLK_T_OUT, dst, NULL, 0, iov, iovcnt, true);
+}
+
+
+void block_completion_init(BlockCompletion* completion, void (*callback)(BlockCompletion* completion), void* data) {
+    completion->requests = NULL;
+    completion->callback = callback;
+    completion->data = data;
+    completion->pending = 1;
+    completion->failed = false;
+}
+
+bool _block_submit_to(VirtioDevice* block_device, uint16_t type, void* dst, void* src, uint32_t size, BlockIovec* iov, uint32_t iovcnt, BlockCompletion* completion) {
+    VirtioBlockRequestInfo* request_info;
+
+    if (completion->callback != NULL) {
+        asm volatile("amoadd.w zero, %0, (%1)" :: "r"(1), "r"(&completion->pending));
+    }
+
+    // Without a callback, block_wait finishes it, so the interrupt handler treats it like a polled one
+    request_info = _block_submit(block_device, type, dst, src, size, iov, iovcnt, completion->callback == NULL, completion);
+    if (request_info == NULL) {
+        completion->failed = true;
+
+        if (completion->callback != NULL) {
+            _block_completion_put(completion);
+        }
+
+        return false;
+    }
+
+    if (completion->callback == NULL) {
+        request_info->next = completion->requests;
+        completion->requests = request_info;
+    }
+
+    return true;
+}
+
+// Starts a request and returns without waiting for it. Type is VIRTIO_BLK_T_*,
+// and dst and src work like they do for block_read and block_write. Writes
+// may read straight from src, so it has to stay put until the request is done.
+bool block_submit(VirtioDevice* block_device, uint16_t type, void* dst, void* src, uint32_t size, BlockCompletion* completion) {
+    return _block_submit_to(block_device, type, dst, src, size, NULL, 0, completion);
+}
+
+// block_submit for block_writev. The buffers in iov have to stay put until
+// it's done, but iov itself doesn't.
+bool block_submit_writev(VirtioDevice* block_device, void* dst, BlockIovec* iov, uint32_t iovcnt, BlockCompletion* completion) {
+    return _block_submit_to(block_device, VIRTIO_BLK_T_OUT, dst, NULL, 0, iov, iovcnt, completion);
+}
+
+// For completions with a callback: nothing else is getting submitted, so the
+// callback can run once what's in flight is done. It runs right here if that's already happened.
+void block_submit_done(BlockCompletion* completion) {
+    _block_completion_put(completion);
+}
+
+// For completions without a callback: waits for and finishes every request
+// submitted so far. Returns false if any of them failed.
+bool block_wait(BlockCompletion* completion) {
+    VirtioBlockRequestInfo* request_info;
+
+    while (completion->requests != NULL) {
+        request_info = completion->requests;
+        completion->requests = request_info->next;
+
+        while (!request_info->complete) {
+            // WFI();
+        }
+
+        asm volatile("fence r, rw" ::: "memory");
+        _block_finish(request_info);
+    }
+
+    return !completion->failed;
 }
@@ -21,6 +21,13 @@
 #include <minix3.h>
 #include <ext4.h>
 #include <vfs.h>
+#include <hartlocal.h>
+#include <rcu.h>
+#include <hrtimer.h>
+#include <trace.h>
+#include <workqueue.h>
+#include <futex.h>
+#include <strace.h>
 
 
 char blocking_getchar() {
@@ -99,6 +106,9 @@ void get_command(ConsoleBuffer* cb) {
 
     clear_buffer(cb);
 
+    // Nothing is held across the prompt
+    rcu_quiescent();
+
     while (1) {
         c = blocking_getchar();
         if (handle_char(c, cb)) {
@@ -170,6 +180,8 @@ int handle_command(ConsoleBuffer* cb) {
         gpu(argc, args);
     } else if (strcmp("exec", args[0]) == 0) {
         exec(argc, args);
+    } else if (strcmp("strace", args[0]) == 0) {
+        strace(argc, args);
     } else {
         printf("Unknown command: %s\n", args[0]);
     }
@@ -256,6 +268,24 @@ void cmd_print(int argc, char** args) {
         mmu_translations_print(kernel_mmu_table, detailed);
     } else if (strcmp("schedule", args[1]) == 0) {
         schedule_print();
+    } else if (strcmp("harts", args[1]) == 0) {
+        hartlocal_print();
+    } else if (strcmp("trace", args[1]) == 0) {
+        trace_print();
+    } else if (strcmp("latency", args[1]) == 0) {
+        trace_print_histograms();
+    } else if (strcmp("hrtimers", args[1]) == 0) {
+        hrtimer_print();
+    } else if (strcmp("futexes", args[1]) == 0) {
+        futex_print();
+    } else if (strcmp("workqueues", args[1]) == 0) {
+        workqueue_print();
+    } else if (strcmp("rcu", args[1]) == 0) {
+        rcu_print();
+    } else if (strcmp("syscalls", args[1]) == 0) {
+        strace_print_stats();
+    } else if (strcmp("strace", args[1]) == 0) {
+        strace_print();
     } else {
         printf("print: invalid argument: %s\n", args[1]);
     }
@@ -411,6 +441,26 @@ void exec(int argc, char** args) {
         return;
     }
 
+    printf("exec: pid %d\n", p->pid);
+
     schedule_add(p);
     return;
 }
+
+// Toggles logging every syscall the process (and its threads) makes. See print strace.
+void strace(int argc, char** args) {
+    int pid;
+
+    if (argc != 2) {
+        printf("Usage: strace <pid>\n");
+        return;
+    }
+
+    pid = atoi(args[1]);
+    if (pid <= 0 || pid > UINT16_MAX) {
+        printf("strace: invalid pid: %s\n", args[1]);
+        return;
+    }
+
+    printf("strace: pid %d: %s\n", pid, strace_toggle(pid) ? "on" : "off");
+}
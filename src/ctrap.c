@@ -6,29 +6,95 @@
 #include <schedule.h>
 #include <start.h>
 #include <syscall.h>
+#include <hartlocal.h>
+#include <hrtimer.h>
+#include <spawn.h>
 
 
+bool _c_trap_fp_loaded(HartLocal* hl, Process* process) {
+    return hl->fp_owner == process && process->fp_hart == (int) hl->hart;
+}
+
+// Returning to a process whose FP state isn't already in this hart's registers
+// leaves FS off, so its first FP instruction traps here and we load it then.
+// Returns false if it was a real illegal instruction.
+bool _c_trap_fp_restore(HartLocal* hl) {
+    Process* process;
+    u64 sstatus;
+
+    process = hl->current_process;
+    if (process == NULL || _c_trap_fp_loaded(hl, process)) {
+        return false;
+    }
+
+    // Only on long enough to load them. The way out turns it back on.
+    CSR_READ(sstatus, "sstatus");
+    CSR_WRITE("sstatus", sstatus | SSTATUS_FS_CLEAN);
+    process_fp_restore(&process->frame);
+    CSR_WRITE("sstatus", sstatus);
+
+    hl->fp_owner = process;
+    process->fp_hart = hl->hart;
+    hl->fp_stats.restores++;
+
+    return true;
+}
+
+// The trap vector turned FS off for the whole trap. Whoever we're returning to
+// gets it back if its FP state is still sitting in our registers.
+void _c_trap_fp_return(HartLocal* hl) {
+    Process* process;
+
+    process = hl->current_process;
+    if (process != NULL && _c_trap_fp_loaded(hl, process)) {
+        asm volatile("csrs sstatus, %0" :: "r"(SSTATUS_FS_CLEAN));
+    }
+}
+
 void c_trap(void) {
     u64 scause;
     u64 sepc;
+    u64 sip;
     u32 hart;
     bool is_async;
     Process* process;
+    HartLocal* hl;
 
     CSR_READ(scause, "scause");
     CSR_READ(sepc, "sepc");
 
-    hart = sbi_whoami();
+    HARTLOCAL_GET(hl);
+    hart = hl->hart;
+    hl->stats.traps++;
+
+    if (hl->current_process != NULL) {
+        if (hl->current_process->frame.fp_saved) {
+            hl->fp_stats.saves++;
+        } else {
+            hl->fp_stats.skips++;
+        }
+    }
 
     is_async = MCAUSE_IS_ASYNC(scause);
     scause = MCAUSE_NUM(scause);
    
     if (is_async) {
+        hl->stats.interrupts++;
+
         switch (scause) {
+            case 1:
+                // SSIP: another hart put work on our run queue, or a kernel thread is yielding
+                CSR_READ(sip, "sip");
+                CSR_WRITE("sip", sip & ~SIP_SSIP);
+
+                hl->idle_stats.ipis++;
+                hl->need_resched = true;
+                break;
+
             case 5:
                 // STIP
                 sbi_ack_timer();
-                schedule_schedule(hart);
+                hrtimer_interrupt(hart);
                 break;
                 
             case 9:
@@ -38,7 +104,7 @@ void c_trap(void) {
             default:
                 printf("error: c_trap: unhandled asynchronous interrupt: %ld\n", scause);
 
-                process = schedule_get_process_on_hart(hart);
+                process = hl->current_process;
                 schedule_remove(process);
                 schedule_stop(process);
                 schedule_add(process);
@@ -50,20 +116,33 @@ void c_trap(void) {
                 // Syscall
                 CSR_WRITE("sepc", sepc + 4);    // Return to next instruction
 
-                process = schedule_get_process_on_hart(hart);
-                syscall_handle(process);
+                hl->stats.syscalls++;
+                syscall_handle(hl->current_process);
                 break;
                 
+            case 2:
+                // Illegal instruction
+                if (_c_trap_fp_restore(hl)) {
+                    break;
+                }
+
+                // fallthrough
             default:
                 printf("error: c_trap: unhandled synchronous interrupt: %ld\n", scause);
 
                 WFI_LOOP();
 
-                process = schedule_get_process_on_hart(hart);
+                process = hl->current_process;
                 schedule_remove(process);
                 schedule_stop(process);
                 schedule_add(process);
                 schedule_schedule(hart);
         }
     }
+
+    if (hl->need_resched) {
+        schedule_schedule(hart);
+    }
+
+    _c_trap_fp_return(hl);
 }
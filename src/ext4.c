@@ -320,7 +320,9 @@ Ext4CacheNode* ext4_get_file(VirtioDevice* block_device, char* path) {
     return current_cnode;
 }
 
-size_t ext4_read_extent(VirtioDevice* block_device, Ext4ExtentHeader* extent_header, void* buf, size_t filesize) {
+// Submits a read for every leaf extent under extent_header without waiting
+// for any of them, so they're all in flight at once
+size_t _ext4_read_extent(VirtioDevice* block_device, Ext4ExtentHeader* extent_header, void* buf, size_t filesize, BlockCompletion* completion) {
     Ext4Extent* extent;
     Ext4ExtentIndex* extent_index;
     size_t count;
@@ -335,7 +337,7 @@ size_t ext4_read_extent(VirtioDevice* block_device, Ext4ExtentHeader* extent_hea
 
     sb_ptr = map_get(ext4_superblocks, (u64) block_device);
     if (sb_ptr == NULL) {
-        printf("ext4_read_extent: no superblock for block device: 0x%08lx\n", (u64) block_device);
+        printf("_ext4_read_extent: no superblock for block device: 0x%08lx\n", (u64) block_device);
         return -1UL;
     }
 
@@ -356,8 +358,8 @@ size_t ext4_read_extent(VirtioDevice* block_device, Ext4ExtentHeader* extent_hea
                 count = filesize - offset;
             }
 
-            if (!block_read_poll(block_device, buf + offset, block_addr, count)) {
-                printf("ext4_read_extent: extent leaf read failed\n");
+            if (!block_submit(block_device, VIRTIO_BLK_T_IN, buf + offset, block_addr, count, completion)) {
+                printf("_ext4_read_extent: extent leaf read failed\n");
                 return -1UL;
             }
 
@@ -375,20 +377,20 @@ size_t ext4_read_extent(VirtioDevice* block_device, Ext4ExtentHeader* extent_hea
         block_addr = GET_BLOCK_ADDR(EXT4_COMBINE_VAL32(extent_index->ei_leaf_hi, extent_index->ei_leaf), ext4_sb);
 
         if (!block_read_poll(block_device, block, block_addr, count)) {
-            printf("ext4_read_extent: extent index read failed\n");
+            printf("_ext4_read_extent: extent index read failed\n");
 
             kfree(block);
             return -1UL;
         }
 
         if (block->eh_depth >= extent_header->eh_depth) {
-            printf("ext4_read_extent: child depth >= parent depth: %d >= %d\n", block->eh_depth, extent_header->eh_depth);
+            printf("_ext4_read_extent: child depth >= parent depth: %d >= %d\n", block->eh_depth, extent_header->eh_depth);
             
             kfree(block);
             return -1UL;
         }
 
-        num_read = ext4_read_extent(block_device, block, buf, filesize);
+        num_read = _ext4_read_extent(block_device, block, buf, filesize, completion);
         if (num_read == -1UL) {
             kfree(block);
             return -1UL;
@@ -401,6 +403,22 @@ size_t ext4_read_extent(VirtioDevice* block_device, Ext4ExtentHeader* extent_hea
     return total_read;
 }
 
+size_t ext4_read_extent(VirtioDevice* block_device, Ext4ExtentHeader* extent_header, void* buf, size_t filesize) {
+    BlockCompletion completion;
+    size_t num_read;
+
+    block_completion_init(&completion, NULL, NULL);
+
+    num_read = _ext4_read_extent(block_device, extent_header, buf, filesize, &completion);
+
+    // Whatever did get submitted still points into buf, so wait even if something failed
+    if (!block_wait(&completion) || num_read == -1UL) {
+        return -1UL;
+    }
+
+    return num_read;
+}
+
 size_t ext4_read_file(VirtioDevice* block_device, char* path, void* buf, size_t count) {
     Ext4CacheNode* cnode;
     Ext4ExtentHeader* extent_header;
@@ -426,6 +444,149 @@ size_t ext4_read_file(VirtioDevice* block_device, char* path, void* buf, size_t
     return ext4_read_extent(block_device, extent_header, buf, count);
 }
 
+// Reads whatever part of [offset, offset + count) the extents under extent_header
+// cover into buf, which starts at offset. Only descends into index entries
+// whose range overlaps. Holes are left alone. Leaf reads are only submitted,
+// block_wait on completion for them.
+bool _ext4_read_extent_at(VirtioDevice* block_device, Ext4SuperBlock* sb, Ext4ExtentHeader* extent_header, void* buf, u64 count, u64 offset, BlockCompletion* completion) {
+    Ext4Extent* extent;
+    Ext4ExtentIndex* extent_index;
+    Ext4ExtentHeader* block;
+    u64 block_size;
+    u64 start;
+    u64 end;
+    u64 len;
+    u64 next_start;
+    u32 i;
+
+    block_size = EXT4_GET_BLOCKSIZE((*sb));
+
+    if (extent_header->eh_depth == 0) {
+        for (i = 0; i < extent_header->eh_entries; i++) {
+            extent = (void*) extent_header + sizeof(Ext4ExtentHeader) + i * sizeof(Ext4Extent);
+
+            // Lengths over 32768 mark unwritten extents, which read as zeroes
+            len = extent->ee_len;
+            if (len > 32768) {
+                continue;
+            }
+
+            start = (u64) extent->ee_block * block_size;
+            end = start + len * block_size;
+            if (end <= offset || start >= offset + count) {
+                continue;
+            }
+
+            if (start < offset) {
+                start = offset;
+            }
+
+            if (end > offset + count) {
+                end = offset + count;
+            }
+
+            if (
+                !block_submit(
+                    block_device,
+                    VIRTIO_BLK_T_IN,
+                    buf + (start - offset),
+                    GET_BLOCK_ADDR(EXT4_COMBINE_VAL32(extent->ee_start_hi, extent->ee_start), (*sb)) + (start - (u64) extent->ee_block * block_size),
+                    end - start,
+                    completion
+                )
+            ) {
+                printf("_ext4_read_extent_at: extent leaf read failed\n");
+                return false;
+            }
+        }
+
+        return true;
+    }
+
+    block = kmalloc(block_size);
+    for (i = 0; i < extent_header->eh_entries; i++) {
+        extent_index = (void*) extent_header + sizeof(Ext4ExtentHeader) + i * sizeof(Ext4ExtentIndex);
+
+        // Each index covers up to where the next one starts
+        start = (u64) extent_index->ei_block * block_size;
+        if (start >= offset + count) {
+            break;
+        }
+
+        if (i + 1 < extent_header->eh_entries) {
+            next_start = (u64) (extent_index + 1)->ei_block * block_size;
+            if (next_start <= offset) {
+                continue;
+            }
+        }
+
+        if (!block_read_poll(block_device, block, GET_BLOCK_ADDR(EXT4_COMBINE_VAL32(extent_index->ei_leaf_hi, extent_index->ei_leaf), (*sb)), block_size)) {
+            printf("_ext4_read_extent_at: extent index read failed\n");
+            kfree(block);
+            return false;
+        }
+
+        if (block->eh_depth >= extent_header->eh_depth) {
+            printf("_ext4_read_extent_at: child depth >= parent depth: %d >= %d\n", block->eh_depth, extent_header->eh_depth);
+            kfree(block);
+            return false;
+        }
+
+        if (!_ext4_read_extent_at(block_device, sb, block, buf, count, offset, completion)) {
+            kfree(block);
+            return false;
+        }
+    }
+
+    kfree(block);
+    return true;
+}
+
+// Reads up to count bytes starting offset bytes into the file
+size_t ext4_read_at(VirtioDevice* block_device, Ext4CacheNode* cnode, void* buf, size_t count, uint64_t offset) {
+    Ext4SuperBlock* sb_ptr;
+    Ext4SuperBlock ext4_sb;
+    BlockCompletion completion;
+    u64 filesize;
+    bool ok;
+
+    sb_ptr = map_get(ext4_superblocks, (u64) block_device);
+    if (sb_ptr == NULL) {
+        printf("ext4_read_at: no superblock for block device: 0x%08lx\n", (u64) block_device);
+        return -1UL;
+    }
+
+    ext4_sb = *sb_ptr;
+
+    if (!(cnode->inode.i_flags & EXT4_EXTENTS_FL)) {
+        printf("ext4_read_at: extents must be enabled\n");
+        return -1UL;
+    }
+
+    filesize = EXT4_COMBINE_VAL32(cnode->inode.i_size_high, cnode->inode.i_size);
+    if (offset >= filesize) {
+        return 0;
+    }
+
+    if (count > filesize - offset) {
+        count = filesize - offset;
+    }
+
+    // Holes don't get read, so they have to already be zero
+    memset(buf, 0, count);
+
+    block_completion_init(&completion, NULL, NULL);
+
+    ok = _ext4_read_extent_at(block_device, &ext4_sb, (Ext4ExtentHeader*) cnode->inode.i_block, buf, count, offset, &completion);
+
+    // Whatever did get submitted still points into buf, so wait even if something failed
+    if (!block_wait(&completion) || !ok) {
+        return -1UL;
+    }
+
+    return count;
+}
+
 size_t ext4_get_filesize(VirtioDevice* block_device, char* path) {
     Ext4CacheNode* cnode;
 
@@ -0,0 +1,206 @@
+// futex.c
+// Blocking on a word of user memory. A waiter checks the word and queues itself
+// under its bucket's lock, and a waker takes the same lock after changing the
+// word, so a wakeup can't slip in between the check and the sleep.
+
+
+#include <futex.h>
+#include <schedule.h>
+#include <hrtimer.h>
+#include <sbi.h>
+#include <csr.h>
+#include <mmu.h>
+#include <printf.h>
+#include <rs_int.h>
+
+
+FutexBucket futex_buckets[FUTEX_HASH_SIZE];
+
+
+bool futex_init() {
+    u32 i;
+
+    for (i = 0; i < FUTEX_HASH_SIZE; i++) {
+        futex_buckets[i].lock = MUTEX_UNLOCKED;
+        futex_buckets[i].waiters = list_new();
+    }
+
+    return true;
+}
+
+FutexBucket* _futex_bucket(u64 paddr) {
+    return &futex_buckets[((paddr >> 2) * 0x9e3779b97f4a7c15UL) >> (64 - FUTEX_HASH_BITS)];
+}
+
+// Returns 0 if addr isn't an aligned word of readable user memory.
+// The kernel is mapped in every process's table, so being mapped isn't enough.
+u64 _futex_translate(Process* process, u64 addr) {
+    u64 paddr;
+    u8 flags;
+
+    if (addr % sizeof(u32) != 0) {
+        return 0;
+    }
+
+    flags = mmu_flags(process->rcb->ptable, addr);
+    if ((flags & (PB_VALID | PB_USER | PB_READ)) != (PB_VALID | PB_USER | PB_READ)) {
+        return 0;
+    }
+
+    paddr = mmu_translate(process->rcb->ptable, addr);
+    if (paddr == -1UL) {
+        return 0;
+    }
+
+    return paddr;
+}
+
+void _futex_timeout(void* data) {
+    Process* process;
+    FutexBucket* bucket;
+    u64 paddr;
+
+    process = data;
+
+    // Woken for real while the timer was firing
+    paddr = *(volatile u64*) &process->futex_paddr;
+    if (paddr == 0) {
+        return;
+    }
+
+    bucket = _futex_bucket(paddr);
+
+    mutex_sbi_lock(&bucket->lock);
+
+    if (process->futex_paddr != paddr) {
+        mutex_unlock(&bucket->lock);
+        return;
+    }
+
+    list_remove(bucket->waiters, process);
+    process->futex_paddr = 0;
+    process->frame.gpregs[XREG_A0] = FUTEX_TIMED_OUT;
+    bucket->stats.timeouts++;
+
+    mutex_unlock(&bucket->lock);
+
+    schedule_wake(process);
+}
+
+// Sleeps the current process on hart until addr gets a futex_wake, as long as
+// the word at addr still holds val. A timeout of 0 waits forever.
+// The result goes straight into process's a0, since it may be running
+// somewhere else by the time this returns.
+void futex_wait(int hart, Process* process, uint64_t addr, uint32_t val, uint64_t timeout) {
+    FutexBucket* bucket;
+    u64 paddr;
+
+    paddr = _futex_translate(process, addr);
+    if (paddr == 0) {
+        process->frame.gpregs[XREG_A0] = FUTEX_AGAIN;
+        return;
+    }
+
+    bucket = _futex_bucket(paddr);
+
+    mutex_sbi_lock(&bucket->lock);
+
+    if (*(volatile u32*) paddr != val) {
+        bucket->stats.mismatches++;
+        mutex_unlock(&bucket->lock);
+        process->frame.gpregs[XREG_A0] = FUTEX_AGAIN;
+        return;
+    }
+
+    process->frame.gpregs[XREG_A0] = FUTEX_WOKEN;
+    process->futex_paddr = paddr;
+    process->state = PS_WAITING;
+    list_insert_after(bucket->waiters, bucket->waiters->last, process);
+    bucket->stats.waits++;
+
+    if (timeout != 0) {
+        hrtimer_prepare(&process->sleep_timer, _futex_timeout, process);
+        hrtimer_start(&process->sleep_timer, hart, sbi_get_time() + timeout, HRTIMER_SLEEP_SLACK);
+    }
+
+    // Get all the way off the hart before a waker can find us,
+    // or it could start us somewhere else while we're still here
+    schedule_park(hart);
+
+    mutex_unlock(&bucket->lock);
+
+    schedule_schedule(hart);
+}
+
+// Wakes up to n processes waiting on addr, oldest first. Returns how many woke.
+uint64_t futex_wake(Process* process, uint64_t addr, uint64_t n) {
+    FutexBucket* bucket;
+    ListNode* it;
+    Process* waiter;
+    u64 paddr;
+    u64 woken;
+
+    paddr = _futex_translate(process, addr);
+    if (paddr == 0) {
+        return 0;
+    }
+
+    bucket = _futex_bucket(paddr);
+    woken = 0;
+
+    mutex_sbi_lock(&bucket->lock);
+
+    it = bucket->waiters->head;
+    while (it != NULL && woken < n) {
+        waiter = it->data;
+        it = it->next;
+
+        if (waiter->futex_paddr != paddr) {
+            continue;
+        }
+
+        list_remove(bucket->waiters, waiter);
+        waiter->futex_paddr = 0;
+        hrtimer_cancel(&waiter->sleep_timer);
+        schedule_wake(waiter);
+
+        woken++;
+    }
+
+    bucket->stats.wakes += woken;
+
+    mutex_unlock(&bucket->lock);
+
+    return woken;
+}
+
+
+void futex_print() {
+    FutexBucket* bucket;
+    ListNode* it;
+    u32 i;
+
+    for (i = 0; i < FUTEX_HASH_SIZE; i++) {
+        bucket = &futex_buckets[i];
+        if (bucket->stats.waits == 0 && bucket->stats.mismatches == 0) {
+            continue;
+        }
+
+        printf(
+            "futex_print: bucket: %d, waits: %ld, wakes: %ld, timeouts: %ld, mismatches: %ld\n",
+            i,
+            bucket->stats.waits,
+            bucket->stats.wakes,
+            bucket->stats.timeouts,
+            bucket->stats.mismatches
+        );
+
+        mutex_sbi_lock(&bucket->lock);
+
+        for (it = bucket->waiters->head; it != NULL; it = it->next) {
+            printf("futex_print:     pid: %d, paddr: 0x%lx\n", ((Process*) it->data)->pid, ((Process*) it->data)->futex_paddr);
+        }
+
+        mutex_unlock(&bucket->lock);
+    }
+}
@@ -5,6 +5,7 @@
 #include <kmalloc.h>
 #include <csr.h>
 #include <printf.h>
+#include <osinfo.h>
 
 
 VirtioDevice* virtio_gpu_device;
@@ -64,6 +65,7 @@ void gpu_handle_irq(VirtioDevice* virtio_gpu_device) {
                         rect = ((VirtioGpuDisplayInfoResponse*) response)->displays[i].rect;
                         ((VirtioGpuDeviceInfo*) virtio_gpu_device->device_info)->displays[i].rect = rect;
                         ((VirtioGpuDeviceInfo*) virtio_gpu_device->device_info)->displays[i].enabled = true;
+                        osinfo_set_display(i, rect, true);
                     }
                 } else {
                     printf("gpu_handle_irq: non-OK_DISPLAY_INFO control type: 0x%04x, idx: %d\n", response->hdr.control_type, id);
@@ -0,0 +1,103 @@
+#include <hartlocal.h>
+#include <kmalloc.h>
+#include <schedule.h>
+#include <string.h>
+#include <printf.h>
+#include <rs_int.h>
+
+
+HartLocal hart_locals[NUM_HARTS];
+
+
+void hartlocal_init(int hart) {
+    u32 i;
+
+    for (i = 0; i < NUM_HARTS; i++) {
+        hart_locals[i].hart = i;
+    }
+
+    // The booting hart keeps its tp for as long as it's in the kernel.
+    // Every other hart gets tp from its process frame on each trap.
+    HARTLOCAL_SET(&hart_locals[hart]);
+}
+
+int hartlocal_whoami(void) {
+    HartLocal* hl;
+
+    HARTLOCAL_GET(hl);
+
+    return hl->hart;
+}
+
+// Stack-like scratch memory for short-lived allocations in the kernel.
+// Falls back to kzalloc when the arena is full, so it never fails.
+void* hartlocal_scratch_push(size_t size) {
+    HartLocal* hl;
+    void* mem;
+
+    HARTLOCAL_GET(hl);
+
+    size = (size + 7) & ~7UL;
+    if (hl->scratch_used + size > HARTLOCAL_SCRATCH_SIZE) {
+        return kzalloc(size);
+    }
+
+    mem = hl->scratch + hl->scratch_used;
+    hl->scratch_used += size;
+
+    memset(mem, 0, size);
+
+    return mem;
+}
+
+// Frees mark and everything pushed after it
+void hartlocal_scratch_pop(void* mark) {
+    HartLocal* hl;
+
+    HARTLOCAL_GET(hl);
+
+    if ((u8*) mark < hl->scratch || (u8*) mark >= hl->scratch + HARTLOCAL_SCRATCH_SIZE) {
+        kfree(mark);
+        return;
+    }
+
+    hl->scratch_used = (u8*) mark - hl->scratch;
+}
+
+
+void hartlocal_print() {
+    HartLocal* hl;
+    u32 i;
+
+    for (i = 0; i < NUM_HARTS; i++) {
+        hl = &hart_locals[i];
+
+        printf(
+            "hartlocal_print: hart: %d, traps: %ld, interrupts: %ld, syscalls: %ld, switches: %ld, cold starts: %ld\n",
+            hl->hart,
+            hl->stats.traps,
+            hl->stats.interrupts,
+            hl->stats.syscalls,
+            hl->stats.switches,
+            hl->stats.cold_starts
+        );
+
+        // Idle used to take a timer interrupt every PROCESS_IDLE_QUANTUM
+        printf(
+            "hartlocal_print: hart: %d, idle entries: %ld, idle ticks: %ld, ipis: %ld, timer interrupts avoided: %ld\n",
+            hl->hart,
+            hl->idle_stats.entries,
+            hl->idle_stats.ticks,
+            hl->idle_stats.ipis,
+            hl->idle_stats.ticks / (PROCESS_IDLE_QUANTUM * SCHEDULE_CTX_TIME)
+        );
+
+        printf(
+            "hartlocal_print: hart: %d, fp saves: %ld, fp saves skipped: %ld, lazy fp restores: %ld\n",
+            hl->hart,
+            hl->fp_stats.saves,
+            hl->fp_stats.skips,
+            hl->fp_stats.restores
+        );
+    }
+}
@@ -0,0 +1,291 @@
+// hrtimer.c
+// Multiplexes each hart's single CLINT timer between any number of timers.
+// Each timer has a window [expires, deadline]. The CLINT is always set to the
+// earliest deadline, and when it goes off everything whose window has
+// opened runs too, so nearby timers cost one interrupt instead of several.
+// A second heap ordered by expires finds those without searching.
+
+
+#include <hrtimer.h>
+#include <sbi.h>
+#include <printf.h>
+#include <rs_int.h>
+
+
+HrTimerBase hrtimer_bases[NUM_HARTS];
+
+
+// Heap helpers. which is HRTIMER_BY_DEADLINE or HRTIMER_BY_EXPIRES.
+// The caller must hold base->lock.
+
+u64 _hrtimer_key(HrTimer* timer, u32 which) {
+    return which == HRTIMER_BY_DEADLINE ? timer->deadline : timer->expires;
+}
+
+void _hrtimer_swap(HrTimerBase* base, u32 which, u32 a, u32 b) {
+    HrTimer** heap;
+    HrTimer* tmp;
+
+    heap = base->heap[which];
+
+    tmp = heap[a];
+    heap[a] = heap[b];
+    heap[b] = tmp;
+
+    heap[a]->index[which] = a;
+    heap[b]->index[which] = b;
+}
+
+void _hrtimer_sift_up(HrTimerBase* base, u32 which, u32 i) {
+    HrTimer** heap;
+    u32 parent;
+
+    heap = base->heap[which];
+
+    while (i > 0) {
+        parent = (i - 1) / 2;
+        if (_hrtimer_key(heap[parent], which) <= _hrtimer_key(heap[i], which)) {
+            break;
+        }
+
+        _hrtimer_swap(base, which, parent, i);
+        i = parent;
+    }
+}
+
+void _hrtimer_sift_down(HrTimerBase* base, u32 which, u32 i) {
+    HrTimer** heap;
+    u32 left;
+    u32 right;
+    u32 smallest;
+
+    heap = base->heap[which];
+
+    while (true) {
+        left = 2 * i + 1;
+        right = 2 * i + 2;
+        smallest = i;
+
+        if (left < base->nr_timers && _hrtimer_key(heap[left], which) < _hrtimer_key(heap[smallest], which)) {
+            smallest = left;
+        }
+
+        if (right < base->nr_timers && _hrtimer_key(heap[right], which) < _hrtimer_key(heap[smallest], which)) {
+            smallest = right;
+        }
+
+        if (smallest == i) {
+            break;
+        }
+
+        _hrtimer_swap(base, which, i, smallest);
+        i = smallest;
+    }
+}
+
+void _hrtimer_heap_insert(HrTimerBase* base, HrTimer* timer) {
+    u32 which;
+
+    for (which = 0; which < HRTIMER_NR_HEAPS; which++) {
+        timer->index[which] = base->nr_timers;
+        base->heap[which][base->nr_timers] = timer;
+    }
+
+    base->nr_timers++;
+
+    for (which = 0; which < HRTIMER_NR_HEAPS; which++) {
+        _hrtimer_sift_up(base, which, timer->index[which]);
+    }
+}
+
+void _hrtimer_heap_remove(HrTimerBase* base, HrTimer* timer) {
+    HrTimer** heap;
+    u32 which;
+    u32 i;
+
+    base->nr_timers--;
+
+    for (which = 0; which < HRTIMER_NR_HEAPS; which++) {
+        heap = base->heap[which];
+        i = timer->index[which];
+
+        if (i != base->nr_timers) {
+            heap[i] = heap[base->nr_timers];
+            heap[i]->index[which] = i;
+
+            _hrtimer_sift_up(base, which, i);
+            _hrtimer_sift_down(base, which, heap[i]->index[which]);
+        }
+    }
+
+    timer->hart = -1;
+}
+
+// Point the CLINT at the earliest deadline, if it isn't already
+void _hrtimer_program(HrTimerBase* base, int hart) {
+    u64 next;
+
+    next = base->nr_timers == 0 ? HRTIMER_TIME_INFINITE : base->heap[HRTIMER_BY_DEADLINE][0]->deadline;
+    if (next == base->programmed) {
+        return;
+    }
+
+    base->programmed = next;
+    base->stats.reprograms++;
+    sbi_set_timer(hart, next);
+}
+
+
+bool hrtimer_init() {
+    u32 i;
+
+    for (i = 0; i < NUM_HARTS; i++) {
+        hrtimer_bases[i].lock = MUTEX_UNLOCKED;
+        hrtimer_bases[i].nr_timers = 0;
+        hrtimer_bases[i].programmed = HRTIMER_TIME_INFINITE;
+    }
+
+    return true;
+}
+
+void hrtimer_prepare(HrTimer* timer, void (*func)(void*), void* data) {
+    timer->expires = 0;
+    timer->deadline = 0;
+    timer->func = func;
+    timer->data = data;
+    timer->hart = -1;
+    timer->index[HRTIMER_BY_DEADLINE] = 0;
+    timer->index[HRTIMER_BY_EXPIRES] = 0;
+}
+
+// Arms timer on hart to fire somewhere in [expires, expires + slack].
+// Rearming an armed timer moves it.
+bool hrtimer_start(HrTimer* timer, int hart, uint64_t expires, uint64_t slack) {
+    HrTimerBase* base;
+
+    if (!IS_VALID_HART(hart)) {
+        printf("hrtimer_start: invalid hart: %d\n", hart);
+        return false;
+    }
+
+    hrtimer_cancel(timer);
+
+    base = &hrtimer_bases[hart];
+
+    mutex_sbi_lock(&base->lock);
+
+    if (base->nr_timers >= HRTIMER_HEAP_SIZE) {
+        mutex_unlock(&base->lock);
+        printf("hrtimer_start: hart %d has too many timers\n", hart);
+        return false;
+    }
+
+    timer->expires = expires;
+    timer->deadline = expires + slack;
+    timer->hart = hart;
+    _hrtimer_heap_insert(base, timer);
+
+    _hrtimer_program(base, hart);
+
+    mutex_unlock(&base->lock);
+
+    return true;
+}
+
+// Returns false if the timer wasn't armed (or has already fired)
+bool hrtimer_cancel(HrTimer* timer) {
+    HrTimerBase* base;
+    int hart;
+
+    // The timer can fire and be rearmed on another hart between reading
+    // hart and locking, so recheck
+    while (true) {
+        hart = *(volatile int*) &timer->hart;
+        if (hart == -1) {
+            return false;
+        }
+
+        base = &hrtimer_bases[hart];
+
+        mutex_sbi_lock(&base->lock);
+
+        if (timer->hart == hart) {
+            _hrtimer_heap_remove(base, timer);
+            _hrtimer_program(base, hart);
+            mutex_unlock(&base->lock);
+            return true;
+        }
+
+        mutex_unlock(&base->lock);
+    }
+}
+
+// Armed timer whose window opened first, if it has opened by now, or NULL
+HrTimer* _hrtimer_find_open(HrTimerBase* base, u64 now) {
+    HrTimer* timer;
+
+    if (base->nr_timers == 0) {
+        return NULL;
+    }
+
+    timer = base->heap[HRTIMER_BY_EXPIRES][0];
+    if (timer->expires > now) {
+        return NULL;
+    }
+
+    return timer;
+}
+
+// Called from the timer interrupt after it's been acked.
+// Callbacks run with the base unlocked so they can rearm themselves,
+// so the root gets looked at again after each one.
+void hrtimer_interrupt(int hart) {
+    HrTimerBase* base;
+    HrTimer* timer;
+    u64 current_time;
+
+    base = &hrtimer_bases[hart];
+
+    mutex_sbi_lock(&base->lock);
+
+    // The ack threw away whatever was programmed
+    base->programmed = HRTIMER_TIME_INFINITE;
+
+    current_time = sbi_get_time();
+    while ((timer = _hrtimer_find_open(base, current_time)) != NULL) {
+        _hrtimer_heap_remove(base, timer);
+
+        base->stats.fired++;
+        if (timer->deadline > current_time) {
+            base->stats.coalesced++;
+        }
+
+        mutex_unlock(&base->lock);
+        timer->func(timer->data);
+        mutex_sbi_lock(&base->lock);
+    }
+
+    _hrtimer_program(base, hart);
+
+    mutex_unlock(&base->lock);
+}
+
+
+void hrtimer_print() {
+    HrTimerBase* base;
+    u32 i;
+
+    for (i = 0; i < NUM_HARTS; i++) {
+        base = &hrtimer_bases[i];
+
+        printf(
+            "hrtimer_print: hart: %d, armed: %d, next: 0x%lx, fired: %ld, coalesced: %ld, reprograms: %ld\n",
+            i,
+            base->nr_timers,
+            base->programmed,
+            base->stats.fired,
+            base->stats.coalesced,
+            base->stats.reprograms
+        );
+    }
+}
@@ -6,6 +6,7 @@
 #include <virtio.h>
 #include <pci.h>
 #include <list.h>
+#include <workqueue.h>
 
 
 #define VIRTIO_BLK_T_IN             0
@@ -19,6 +20,9 @@
 #define VIRTIO_BLK_S_UNSUPP   2
 #define VIRTIO_BLK_S_INCOMP   255
 
+// Reads into buffers more scattered than this get bounced instead
+#define BLOCK_MAX_SEGMENTS    64
+
 
 typedef struct virtio_blk_config {
    uint64_t capacity;
@@ -63,6 +67,28 @@ typedef struct virtio_block_desc_status {
    uint8_t status;
 } VirtioBlockDescStatus;
 
+// A physically contiguous piece of a buffer, one data descriptor's worth
+typedef struct BlockSegment {
+   uint64_t addr;
+   uint32_t len;
+} BlockSegment;
+
+// One of the buffers a vectored write gathers from
+typedef struct BlockIovec {
+   void* base;
+   uint32_t len;
+} BlockIovec;
+
+// Tracks a group of requests in flight at once. Either block_wait for all of
+// them, or give it a callback, which runs once the last one is done.
+typedef struct BlockCompletion {
+   volatile struct virtio_block_request_info* requests;   // Left for block_wait to finish, newest first
+   void (*callback)(struct BlockCompletion* completion);   // NULL to use block_wait
+   void* data;
+   volatile uint32_t pending;    // Requests not done yet, plus one until block_submit_done
+   volatile bool failed;
+} BlockCompletion;
+
 typedef volatile struct virtio_block_request_info {
    VirtioBlockDescHeader* desc_header;
    VirtioBlockDescData* desc_data;
@@ -71,10 +97,24 @@ typedef volatile struct virtio_block_request_info {
    void* src;
    void* data;
    uint32_t size;
+   uint32_t offset;     // Where the requested bytes start in the first sector
+   uint32_t head_size;  // Bytes of dst from a bounced partial first sector, if in_place
+   uint32_t tail_size;  // Bytes of dst from a bounced partial last sector, if in_place
+   uint32_t tail_offset;   // Where that last sector is in data
+   bool in_place;       // The whole sectors were read straight into dst
    bool poll;
-   bool complete;
+   bool complete;       // Set by the interrupt handler for polled requests only
+   Work work;           // Finishes non-polled requests outside the interrupt handler
+   BlockCompletion* completion;
+   volatile struct virtio_block_request_info* next;       // In completion->requests
 } VirtioBlockRequestInfo;
 
+// Descriptors are handed out from a free list, since requests can finish in any order
+typedef struct VirtioBlockDeviceInfo {
+   uint16_t free_head;  // Free descriptors are chained through their next fields
+   volatile uint16_t num_free;
+} VirtioBlockDeviceInfo;
+
 
 extern List* virtio_block_devices;
 
@@ -89,3 +129,11 @@ bool block_flush(VirtioDevice* block_Device, void* addr);
 bool block_read_poll(VirtioDevice* block_Device, void* dst, void* src, uint32_t size);
 bool block_write_poll(VirtioDevice* block_Device, void* dst, void* src, uint32_t size);
 bool block_flush_poll(VirtioDevice* block_Device, void* addr);
+bool block_writev(VirtioDevice* block_Device, void* dst, BlockIovec* iov, uint32_t iovcnt);
+bool block_writev_poll(VirtioDevice* block_Device, void* dst, BlockIovec* iov, uint32_t iovcnt);
+
+void block_completion_init(BlockCompletion* completion, void (*callback)(BlockCompletion* completion), void* data);
+bool block_submit(VirtioDevice* block_device, uint16_t type, void* dst, void* src, uint32_t size, BlockCompletion* completion);
+bool block_submit_writev(VirtioDevice* block_device, void* dst, BlockIovec* iov, uint32_t iovcnt, BlockCompletion* completion);
+void block_submit_done(BlockCompletion* completion);
+bool block_wait(BlockCompletion* completion);
@@ -29,3 +29,4 @@ void read(int argc, char** args);
 void write(int argc, char** args);
 void gpu(int argc, char** args);
 void exec(int argc, char** args);
+void strace(int argc, char** args);
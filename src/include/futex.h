@@ -0,0 +1,42 @@
+#pragma once
+
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <lock.h>
+#include <list.h>
+#include <process.h>
+
+
+#define FUTEX_HASH_BITS     6
+#define FUTEX_HASH_SIZE     (1 << FUTEX_HASH_BITS)
+
+// What futex_wait leaves in a0
+#define FUTEX_WOKEN         0
+#define FUTEX_TIMED_OUT     1
+#define FUTEX_AGAIN         -1UL    // The word didn't hold val, or the address was bad
+
+
+typedef struct FutexStats {
+    uint64_t waits;
+    uint64_t wakes;
+    uint64_t timeouts;
+    uint64_t mismatches;
+} FutexStats;
+
+// Waiters are keyed by physical address, so processes sharing a page share futexes
+typedef struct FutexBucket {
+    Mutex lock;
+    List* waiters;
+    FutexStats stats;
+} __attribute__((aligned(64))) FutexBucket;
+
+
+extern FutexBucket futex_buckets[FUTEX_HASH_SIZE];
+
+
+bool futex_init();
+void futex_wait(int hart, Process* process, uint64_t addr, uint32_t val, uint64_t timeout);
+uint64_t futex_wake(Process* process, uint64_t addr, uint64_t n);
+
+void futex_print();
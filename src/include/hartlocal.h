@@ -0,0 +1,77 @@
+#pragma once
+
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include <hart.h>
+#include <process.h>
+#include <rcu.h>
+#include <hrtimer.h>
+
+
+#define HARTLOCAL_ALIGN         64
+#define HARTLOCAL_SCRATCH_SIZE  1024
+
+// HARTLOCAL_GET(variable). Reads this hart's HartLocal pointer out of tp.
+#define HARTLOCAL_GET(var)  asm volatile("mv %0, tp" : "=r"(var))
+
+// HARTLOCAL_SET(variable). Only used when a hart first enters the kernel.
+#define HARTLOCAL_SET(var)  asm volatile("mv tp, %0" :: "r"(var))
+
+
+typedef struct HartStats {
+    uint64_t traps;
+    uint64_t interrupts;
+    uint64_t syscalls;
+    uint64_t switches;
+    uint64_t cold_starts;   // Switches that had to go through SBI hart_start
+} HartStats;
+
+typedef struct IdleStats {
+    uint64_t entries;
+    uint64_t ticks;         // Time spent in wfi with no preemption timer armed
+    uint64_t ipis;
+} IdleStats;
+
+typedef struct FpStats {
+    uint64_t saves;         // Traps that found FP state dirty and saved it
+    uint64_t skips;         // Traps that didn't have to
+    uint64_t restores;      // First FP instructions after a switch that had to load it
+} FpStats;
+
+// Everything in here is only ever written by its own hart,
+// so each one gets its own cache lines.
+typedef struct HartLocal {
+    uint64_t hart;
+    Process* current_process;
+    Process* idle_process;
+    HartStats stats;
+    IdleStats idle_stats;
+    uint64_t idle_since;
+    uint64_t trap_stack;        // Top of the stack every process on this hart traps onto
+    HrTimer preempt_timer;
+    bool need_resched;
+    bool yielding;              // The next park puts current behind everything else queued
+    Process* fp_owner;          // Whose FP state is in this hart's registers, if anyone's
+    FpStats fp_stats;
+    uint32_t asid_generation;   // process_asid_generation as of this hart's last full sfence
+    uint64_t rcu_state;         // (epoch << 1) | active
+    uint32_t rcu_nesting;
+    RcuCallback* rcu_callbacks;
+    RcuCallback* rcu_callbacks_tail;
+    RcuStats rcu_stats;
+    size_t scratch_used;
+    uint8_t scratch[HARTLOCAL_SCRATCH_SIZE];
+} __attribute__((aligned(HARTLOCAL_ALIGN))) HartLocal;
+
+
+extern HartLocal hart_locals[NUM_HARTS];
+
+
+void hartlocal_init(int hart);
+int hartlocal_whoami(void);
+void* hartlocal_scratch_push(size_t size);
+void hartlocal_scratch_pop(void* mark);
+
+void hartlocal_print();
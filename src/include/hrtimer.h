@@ -0,0 +1,59 @@
+#pragma once
+
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <lock.h>
+#include <hart.h>
+
+
+// Max armed timers per hart
+#define HRTIMER_HEAP_SIZE       256
+
+#define HRTIMER_TIME_INFINITE   -1UL
+
+// Sleepers don't care about a few microseconds, and letting them
+// fire together saves a trap per extra timer
+#define HRTIMER_SLEEP_SLACK     500UL
+
+// Every armed timer is in both of its hart's heaps
+#define HRTIMER_BY_DEADLINE     0   // Root is what the CLINT should be set to
+#define HRTIMER_BY_EXPIRES      1   // Root is the first window to open
+#define HRTIMER_NR_HEAPS        2
+
+
+typedef struct HrTimer {
+    uint64_t expires;   // Earliest time the timer may fire
+    uint64_t deadline;  // Latest time the timer may fire (expires + slack)
+    void (*func)(void*);
+    void* data;
+    int hart;           // -1 if not armed
+    uint32_t index[HRTIMER_NR_HEAPS];   // Position in each of its hart's heaps
+} HrTimer;
+
+typedef struct HrTimerStats {
+    uint64_t fired;
+    uint64_t coalesced;     // Fired early because their slack window was already open
+    uint64_t reprograms;
+} HrTimerStats;
+
+// Two min-heaps over the same timers, one by deadline and one by expires
+typedef struct HrTimerBase {
+    Mutex lock;
+    HrTimer* heap[HRTIMER_NR_HEAPS][HRTIMER_HEAP_SIZE];
+    uint32_t nr_timers;
+    uint64_t programmed;
+    HrTimerStats stats;
+} __attribute__((aligned(64))) HrTimerBase;
+
+
+extern HrTimerBase hrtimer_bases[NUM_HARTS];
+
+
+bool hrtimer_init();
+void hrtimer_prepare(HrTimer* timer, void (*func)(void*), void* data);
+bool hrtimer_start(HrTimer* timer, int hart, uint64_t expires, uint64_t slack);
+bool hrtimer_cancel(HrTimer* timer);
+void hrtimer_interrupt(int hart);
+
+void hrtimer_print();
@@ -7,10 +7,14 @@
 #include <pci.h>
 #include <input-event-codes.h>
 #include <lock.h>
+#include <workqueue.h>
 
 
 #define VIRTIO_INPUT_EVENT_BUFFER_SIZE 512
 
+// Must be a power of 2
+#define INPUT_KEYBOARD_LOG_SIZE 64
+
 
 typedef enum virtio_input_config_select {
     VIRTIO_INPUT_CFG_UNSET = 0x00,
@@ -66,6 +70,17 @@ typedef struct virtio_input_event_ring_buffer {
     uint32_t size;
 } VirtioInputEventRingBuffer;
 
+// Keyboard events waiting to be printed. Only the interrupt handler moves head,
+// and only whoever holds lock moves tail.
+typedef struct InputEventLog {
+    VirtioInputEvent events[INPUT_KEYBOARD_LOG_SIZE];
+    volatile uint32_t head;
+    volatile uint32_t tail;
+    uint64_t dropped;
+    Mutex lock;
+    Work work;
+} InputEventLog;
+
 
 extern VirtioDeviceList* virtio_input_device_head;
 
@@ -75,6 +90,8 @@ extern VirtioDevice* virtio_input_tablet_device;
 extern VirtioInputEventRingBuffer virtio_input_event_ring_buffer;
 extern Mutex virtio_input_event_ring_buffer_lock;
 
+extern InputEventLog input_keyboard_log;
+
 
 bool virtio_input_driver(volatile EcamHeader* ecam);
 
@@ -0,0 +1,15 @@
+#pragma once
+
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <process.h>
+
+
+#define KTHREAD_STACK_PAGES     2
+
+
+Process* kthread_new(void (*func)(void*), void* data);
+void kthread_yield(void);
+void kthread_preempt_point(void);
+void kthread_exit(void);
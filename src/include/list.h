@@ -22,3 +22,5 @@ ListNode* list_find(List* list, void* data);
 ListNode* list_insert(List* list, void* data);
 ListNode* list_insert_after(List* list, ListNode* node, void* data);
 bool list_remove(List* list, void* data);
+
+ListNode* list_insert_rcu(List* list, void* data);
@@ -12,6 +12,7 @@
 #define MINIX3_SUPERBLOCK_OFFSET    1024UL
 #define MINIX3_ROOT_INODE           1
 #define MINIX3_ZONES_PER_INODE      10
+#define MINIX3_POINTER_LEVELS       3   // Blocks of zone pointers between a triply indirect zone and the data
 #define MINIX3_NAME_SIZE            60
 
 #define S_IFMT      0170000
@@ -102,4 +103,5 @@ bool minix3_cache_inodes(VirtioDevice* block_device);
 Minix3CacheNode* minix3_get_file(VirtioDevice* block_device, char* path);
 size_t minix3_read_zone(VirtioDevice* block_device, uint32_t zone, Minix3ZoneType type, void* buf, size_t count);
 size_t minix3_read_file(VirtioDevice* block_device, char* path, void* buf, size_t count);
+size_t minix3_read_at(VirtioDevice* block_device, Minix3CacheNode* cnode, void* buf, size_t count, uint64_t offset);
 size_t minix3_get_filesize(VirtioDevice* block_device, char* path);
@@ -24,6 +24,10 @@
 
 #define KERNEL_ASID 0xFFFFUL
 
+// Top level slot (1GB) that isn't shared into process tables, because user images
+// live in it too. The kernel only uses it for PLIC and ECAM, from hart 0.
+#define MMU_KERNEL_PRIVATE_SLOT 0
+
 
 typedef struct PageTable {
     uint64_t entries[512];
@@ -33,6 +37,8 @@ bool mmu_init();
 bool mmu_map(PageTable* tb, uint64_t vaddr, uint64_t paddr, uint64_t bits);
 bool mmu_map_many(PageTable* tb, uint64_t vaddr_start, uint64_t paddr_start, uint64_t num_bytes, uint64_t bits);
 void mmu_free(PageTable* tb);
+void mmu_share_kernel(PageTable* tb);
+bool mmu_is_shared(PageTable* tb, uint64_t vaddr);
 uint64_t mmu_translate(PageTable* tb, uint64_t vaddr);
 uint8_t mmu_flags(PageTable* tb, uint64_t vaddr);
 
@@ -0,0 +1,48 @@
+#pragma once
+
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <lock.h>
+#include <list.h>
+#include <mmu.h>
+#include <page_alloc.h>
+#include <gpu.h>
+
+
+// Where every process finds the info pages. The shared page comes first,
+// then the one that belongs to its own address space.
+#define OSINFO_VADDR            0x200000UL
+#define OSINFO_PROCESS_VADDR    (OSINFO_VADDR + PS_4K)
+
+#define OSINFO_TIMEBASE_HZ      10000000UL
+
+
+typedef struct OsInfoDisplay {
+    VirtioGpuRectangle rect;
+    uint32_t enabled;
+} OsInfoDisplay;
+
+// Read-only to user space. Everything but num_harts can change, so readers
+// copy what they want and retry if seq was odd or moved while they did.
+// libc/os.h has its own copy of this layout.
+typedef struct OsInfo {
+    volatile uint32_t seq;
+    uint32_t num_harts;
+    uint64_t time_base;         // time when the kernel booted
+    uint64_t ticks_per_sec;     // rdtime ticks per second
+    OsInfoDisplay displays[VIRTIO_GPU_MAX_SCANOUTS];
+} OsInfo;
+
+// One per address space, so threads see their process's id, not their own
+typedef struct OsProcessInfo {
+    uint32_t pid;
+} OsProcessInfo;
+
+
+extern OsInfo* os_info;
+
+
+bool osinfo_init();
+void osinfo_set_display(uint32_t scanout_id, VirtioGpuRectangle rect, bool enabled);
+bool osinfo_map(PageTable* tb, uint16_t pid, List* pages, uint64_t user_flag);
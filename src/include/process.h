@@ -5,16 +5,30 @@
 #include <stdbool.h>
 #include <list.h>
 #include <mmu.h>
+#include <rbtree.h>
+#include <hrtimer.h>
+#include <lock.h>
 
 
 #define PROCESS_KERNEL_PID KERNEL_ASID
 
 #define PROCESS_DEFAULT_STACK_VADDR         0x1beef0000UL
 #define PROCESS_DEFAULT_STACK_PAGES         8
+#define PROCESS_MAX_THREADS                 64
 #define PROCESS_DEFAULT_TRAP_STACK_PAGES    1
 #define PROCESS_DEFAULT_QUANTUM             100
 #define PROCESS_IDLE_QUANTUM                50
-#define PROCESS_IDLE_ENTRY                  0x10000UL
+
+#define PROCESS_NICE_MIN                    -20
+#define PROCESS_NICE_MAX                    19
+#define PROCESS_NICE_0_WEIGHT               1024
+
+// Each thread's stack sits below the last one's, with an unmapped page between
+// them so running off the end of one faults instead of trashing the next
+#define PROCESS_STACK_VADDR(slot)           (PROCESS_DEFAULT_STACK_VADDR - (slot) * PS_4K * (PROCESS_DEFAULT_STACK_PAGES + 1))
+
+// Bit n set means the process may run on hart n
+#define PROCESS_AFFINITY_ALL                ((1UL << NUM_HARTS) - 1)
 
 
 typedef struct ProcFrame {
@@ -26,23 +40,40 @@ typedef struct ProcFrame {
     uint64_t satp;          // 536
     uint64_t sscratch;      // 544
     uint64_t stvec;         // 552
-    uint64_t trap_satp;     // 560
+    uint64_t trap_satp;     // 560  Unused, traps don't switch satp anymore
     uint64_t trap_stack;    // 568
+    uint64_t kernel_tp;     // 576
+    uint64_t fcsr;          // 584
+    uint64_t fp_saved;      // 592  Set by the trap vector when it had to save FP state
 } ProcFrame;
 
+typedef struct FileDescriptor {
+    int fd;
+    struct OpenFile* file;
+} FileDescriptor;
+
 typedef struct ResourceControlBlock {
     List* image_pages;
     List* stack_pages;
     List* heap_pages;
-    List* file_descriptors;
+    List* file_descriptors; // FileDescriptors, under lock
     // Map* environment;
     PageTable* ptable;
+    Mutex lock;             // Its threads can be in syscalls on several harts at once
+    uint32_t refs;          // Processes sharing it. The last one out frees it.
+    uint32_t next_stack;    // Stack slots handed out, the first is the main thread's
+    struct Ring* ring;      // Submission/completion rings, if it's set them up
+    int next_fd;
+    uint16_t asid;          // Its threads' tgid. Stays taken until the rcb is freed.
 } ResourceControlBlock;
 
 typedef struct ProcessStats {
     uint64_t vruntime;
     uint64_t switches;
     uint64_t starttime;
+    uint64_t enqueuetime;   // When it last went on a run queue
+    uint64_t waketime;      // When it was last woken, 0 once it's run since
+    uint64_t migrations;    // Times it ran on a different hart than last time
 } ProcessStats;
 
 typedef enum ProcState {
@@ -52,10 +83,27 @@ typedef enum ProcState {
     PS_WAITING = 3
 } ProcState;
 
+typedef enum SchedPolicy {
+    SP_NORMAL = 0,  // Weighted fair share
+    SP_FIFO = 1,    // Real-time, runs until it blocks or runs out of budget
+    SP_RR = 2       // Real-time, round robin within a priority
+} SchedPolicy;
+
+// Real-time budget: at most runtime ticks of every period ticks
+typedef struct RtParams {
+    uint8_t priority;       // Higher runs first
+    bool throttled;
+    uint32_t bandwidth;     // runtime / period in SCHEDULE_RT_BW_SCALE units
+    uint64_t runtime;
+    uint64_t period;
+    uint64_t used;
+    uint64_t period_start;
+} RtParams;
+
 typedef struct Process {
     ProcFrame frame;
     ProcState state;
-    ResourceControlBlock rcb;
+    ResourceControlBlock* rcb;     // Shared by every thread in the process
     ProcessStats stats;
 
     List pending_signals;
@@ -63,14 +111,35 @@ typedef struct Process {
     uint64_t sleep_until;
     uint16_t quantum;
     uint16_t pid;
+    uint16_t tgid;  // pid of the thread that created the address space, and its ASID
+    int8_t nice;
+    uint8_t policy;
+    RtParams rt;
+    HrTimer rt_timer;
+    uint32_t weight;    // From nice. vruntime accrues at PROCESS_NICE_0_WEIGHT / weight of wall time.
     int on_hart; // -1 if not running on a HART
+    int rq_hart; // -1 if not queued on any HART
+    int last_hart; // -1 if it's never run
+    int fp_hart; // Hart whose FP registers last had its FP state loaded, -1 if none
+    uint64_t affinity;
+    RbNode rq_node;
+    HrTimer sleep_timer;
+    uint64_t futex_paddr; // 0 unless it's waiting in futex_wait
     bool supervisor_mode;
+    bool kernel_thread; // Runs kernel code on the kernel page table, see kthread.c
 } Process;
 
 
+extern uint32_t process_asid_generation;
+
+
 bool process_init();
 Process* process_new();
 void process_free(Process* process);
+void process_release_pid(uint16_t pid);
+void process_rcb_get(ResourceControlBlock* rcb);
+void process_rcb_put(ResourceControlBlock* rcb);
 bool process_prepare(Process* process);
+Process* process_clone(Process* parent, uint64_t entry, uint64_t a0, uint64_t a1);
 
 bool process_load_elf(Process* process, char* path);
@@ -0,0 +1,37 @@
+#pragma once
+
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+
+#define RB_RED      0
+#define RB_BLACK    1
+
+// RBTREE_ENTRY(node pointer, containing type, member name). Gets the struct an RbNode is embedded in.
+#define RBTREE_ENTRY(ptr, type, member) ((type*) ((uint8_t*) (ptr) - offsetof(type, member)))
+
+
+// Intrusive: embed one of these in whatever you want to keep in a tree
+typedef struct RbNode {
+    struct RbNode* parent;
+    struct RbNode* left;
+    struct RbNode* right;
+    int color;
+} RbNode;
+
+typedef struct RbTree {
+    RbNode* root;
+    RbNode* leftmost;   // Cached so the minimum is O(1)
+    bool (*less)(RbNode* a, RbNode* b);
+} RbTree;
+
+
+void rbtree_init(RbTree* tree, bool (*less)(RbNode* a, RbNode* b));
+void rbtree_insert(RbTree* tree, RbNode* node);
+void rbtree_remove(RbTree* tree, RbNode* node);
+RbNode* rbtree_first(RbTree* tree);
+RbNode* rbtree_next(RbNode* node);
+RbNode* rbtree_last(RbTree* tree);
+RbNode* rbtree_prev(RbNode* node);
@@ -0,0 +1,42 @@
+#pragma once
+
+
+#include <stdint.h>
+#include <stdbool.h>
+
+
+// Callbacks queued in epoch e may run once the global epoch reaches e + RCU_GRACE_EPOCHS
+#define RCU_GRACE_EPOCHS    2
+
+// RCU_ASSIGN_POINTER(pointer, value). Publishes value only after everything it points to is visible.
+#define RCU_ASSIGN_POINTER(p, v)                    \
+    do {                                            \
+        asm volatile("fence rw, w" ::: "memory");   \
+        (p) = (v);                                  \
+    } while (0)
+
+// RCU_DEREFERENCE(pointer). Forces a fresh load of a pointer an updater may be changing.
+#define RCU_DEREFERENCE(p)  (*(volatile __typeof__(p)*) &(p))
+
+
+typedef struct RcuCallback {
+    struct RcuCallback* next;
+    void (*func)(void*);
+    void* data;
+    uint64_t epoch;
+} RcuCallback;
+
+typedef struct RcuStats {
+    uint64_t callbacks_queued;
+    uint64_t callbacks_run;
+    uint64_t quiescent_states;
+} RcuStats;
+
+
+void rcu_read_lock(void);
+void rcu_read_unlock(void);
+void call_rcu(void (*func)(void*), void* data);
+void rcu_free(void* mem);
+void rcu_quiescent(void);
+
+void rcu_print();
@@ -0,0 +1,77 @@
+#pragma once
+
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <lock.h>
+#include <workqueue.h>
+#include <process.h>
+
+
+// Where a process's rings get mapped. The shared header and submission queue
+// are in the first page, the completion queue fills the second.
+#define RING_VADDR          0x210000UL
+#define RING_PAGES          2
+
+// Both must be powers of 2
+#define RING_SQ_ENTRIES     64
+#define RING_CQ_ENTRIES     256
+
+// ring_enter flags
+#define RING_ENTER_ASYNC    (1 << 0)    // Have a kernel worker drain the queue instead
+
+// Submission ops and their args
+typedef enum RingOp {
+    RING_OP_NOP = 0,
+    RING_OP_GPU_FILL,       // 0: scanout, 1: x | y << 32, 2: width | height << 32, 3: pixel
+    RING_OP_GPU_FLUSH,      // 0: scanout, 1: x | y << 32, 2: width | height << 32
+    RING_OP_GET_EVENTS,     // 0: event buffer, 1: max events. Result is how many.
+    RING_OP_READ            // 0: fd, 1: buffer, 2: max bytes. Result is how many.
+} RingOp;
+
+
+typedef struct RingSqe {
+    uint32_t op;
+    uint32_t flags;
+    uint64_t user_data;     // Handed back untouched in the completion
+    uint64_t args[4];
+} RingSqe;
+
+typedef struct RingCqe {
+    uint64_t user_data;
+    int64_t result;         // -1 for a failed or unknown op
+} RingCqe;
+
+// Shared with user space, who owns sq_tail and cq_head. libc/os.h has its own copy.
+typedef struct RingShared {
+    volatile uint32_t sq_head;
+    volatile uint32_t sq_tail;
+    volatile uint32_t cq_head;
+    volatile uint32_t cq_tail;
+    uint32_t sq_entries;
+    uint32_t cq_entries;
+    uint8_t reserved[40];
+    RingSqe sqes[RING_SQ_ENTRIES];
+} RingShared;
+
+typedef struct RingStats {
+    uint64_t enters;
+    uint64_t async_enters;
+    uint64_t submitted;
+    uint64_t cq_full;       // Drains that stopped early for want of completion space
+} RingStats;
+
+typedef struct Ring {
+    RingShared* shared;
+    RingCqe* cqes;
+    Mutex lock;                     // One drain at a time
+    uint64_t satp;                  // The process's, for draining from a worker
+    ResourceControlBlock* rcb;
+    Work work;
+    RingStats stats;
+} Ring;
+
+
+uint64_t ring_setup(Process* process);
+int64_t ring_enter(Process* process, uint32_t flags);
+void ring_free(Ring* ring);
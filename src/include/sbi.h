@@ -3,7 +3,14 @@
 #include <hart.h>
 
 
+extern bool sbi_has_sstc;
+
+
+bool sbi_init(void);
+unsigned long sbi_get_features(void);
+
 void sbi_putchar(char c);
+void sbi_putstring(const char* s, unsigned long len);
 char sbi_getchar(void);
 
 HartStatus sbi_get_hart_status(int hart);
@@ -14,5 +21,6 @@ unsigned long sbi_get_time(void);
 void sbi_set_timer(int hart, unsigned long val);
 void sbi_add_timer(int hart, unsigned long duration);
 void sbi_ack_timer(void);
+bool sbi_send_ipi(int hart);
 
 void sbi_poweroff(void);
@@ -1,21 +1,86 @@
 #pragma once
 
 
+#include <stdint.h>
 #include <stdbool.h>
 #include <process.h>
+#include <list.h>
+#include <lock.h>
+#include <hart.h>
+#include <rbtree.h>
 
 
 #define SCHEDULE_CTX_FREQ_HZ    10000
 #define SCHEDULE_CTX_TIME       (10000000UL / SCHEDULE_CTX_FREQ_HZ)
 
+// Hart 0 runs the console and never picks up processes
+#define SCHEDULE_FIRST_HART     1
+
+// Every this many context switches, a hart checks if it should pull work
+#define SCHEDULE_BALANCE_PERIOD 64
+
+// Harts a process can actually be placed on
+#define SCHEDULE_AFFINITY_MASK  (PROCESS_AFFINITY_ALL & ~((1UL << SCHEDULE_FIRST_HART) - 1))
+
+// SCHEDULE_CAN_RUN_ON(process, hart)
+#define SCHEDULE_CAN_RUN_ON(p, hart)    (((p)->affinity >> (hart)) & 1)
+
+// Stay on the last hart unless another one has at least this many fewer queued
+#define SCHEDULE_CACHE_HOT_SLACK    1
+
+#define SCHEDULE_RT_PRIORITIES      32
+
+// Fixed point for real-time bandwidth, so 1024 is a whole hart
+#define SCHEDULE_RT_BW_SCALE        1024
+
+// Real-time processes get at most 95% of each process hart between them,
+// so a runaway one can't lock out everything else
+#define SCHEDULE_RT_BW_CAP          (SCHEDULE_RT_BW_SCALE * 95 / 100)
+
+#define SCHEDULE_RT_DEFAULT_PERIOD  (10 * PROCESS_DEFAULT_QUANTUM * SCHEDULE_CTX_TIME)
+#define SCHEDULE_RT_DEFAULT_RUNTIME (SCHEDULE_RT_DEFAULT_PERIOD / 2)
+
+// New processes start one default quantum behind everyone already queued
+#define SCHEDULE_NEW_DEBIT      (PROCESS_DEFAULT_QUANTUM * SCHEDULE_CTX_TIME)
+
+// Woken sleepers get at most half a quantum of head start
+#define SCHEDULE_WAKEUP_BONUS   (PROCESS_DEFAULT_QUANTUM * SCHEDULE_CTX_TIME / 2)
+
+
+typedef struct RunQueueStats {
+    uint64_t switches;
+    uint64_t steals;
+    uint64_t balance_pulls;
+    uint64_t rt_throttles;
+} RunQueueStats;
+
+typedef struct RunQueue {
+    Mutex lock;
+    RbTree runnable;    // Keyed by vruntime. Sleepers sit on their hrtimer instead.
+    List* rt_queues[SCHEDULE_RT_PRIORITIES];
+    uint32_t rt_bitmap; // Bit n set if rt_queues[n] isn't empty
+    uint32_t nr_queued;
+    uint64_t min_vruntime;  // Only ever moves forward
+    RunQueueStats stats;
+} __attribute__((aligned(64))) RunQueue;
+
+
+extern RunQueue schedule_run_queues[NUM_HARTS];
+
 
 bool schedule_init();
 void schedule_add(Process* process);
 bool schedule_remove(Process* process);
 Process* schedule_get_process_on_hart(int hart);
 bool schedule_stop(Process* process);
-Process* schedule_pop();
+Process* schedule_pop(int hart);
 void schedule_park(int hart);
+void schedule_sleep(int hart, Process* process, uint64_t duration);
+void schedule_yield(int hart);
+bool schedule_wake(Process* process);
+bool schedule_set_nice(Process* process, int nice);
+bool schedule_set_affinity(Process* process, uint64_t affinity);
+bool schedule_set_scheduler(Process* process, int policy, int priority, uint64_t runtime, uint64_t period);
 void schedule_schedule(int hart);
 
 void schedule_print();
@@ -8,3 +8,6 @@ extern uint64_t process_spawn_addr;
 extern uint64_t process_spawn_size;
 extern uint64_t process_trap_vector_addr;
 extern uint64_t process_trap_vector_size;
+
+
+void process_fp_restore(void* frame);
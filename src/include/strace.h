@@ -0,0 +1,50 @@
+#pragma once
+
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <hart.h>
+#include <syscall.h>
+
+
+// Must be a power of 2
+#define STRACE_RING_SIZE        256
+
+// Every syscall number we don't know about is counted here
+#define STRACE_UNKNOWN          SYS_COUNT
+
+
+typedef struct SyscallStat {
+    uint64_t count;
+    uint64_t total;     // Ticks spent in the handler
+    uint64_t max;
+} SyscallStat;
+
+typedef struct StraceEntry {
+    uint64_t time;      // When the syscall came in
+    uint64_t ticks;     // How long the handler took
+    uint64_t args[4];
+    uint64_t rv;        // a0 when the handler returned. Calls that block may set it later.
+    uint64_t nr;
+    uint16_t pid;
+    uint8_t hart;
+} StraceEntry;
+
+// Same deal as TraceBuffer: only its own hart writes to it
+typedef struct StraceBuffer {
+    StraceEntry ring[STRACE_RING_SIZE];
+    volatile uint64_t head;
+    SyscallStat stats[SYS_COUNT + 1];
+} __attribute__((aligned(64))) StraceBuffer;
+
+
+extern StraceBuffer strace_buffers[NUM_HARTS];
+
+
+bool strace_init();
+bool strace_enabled(uint16_t tgid);
+bool strace_toggle(uint16_t tgid);
+void strace_syscall(int hart, uint16_t pid, bool traced, uint64_t nr, uint64_t args[4], uint64_t rv, uint64_t start, uint64_t end);
+
+void strace_print();
+void strace_print_stats();
@@ -2,7 +2,19 @@
 
 
 #include <stdint.h>
+#include <stddef.h>
 #include <process.h>
+#include <input.h>
+#include <page_alloc.h>
+
+
+#define SYSCALL_PATH_MAX    256
+#define SYSCALL_READ_CHUNK  (4 * PS_4K)
+
+// open flags
+#define O_RDONLY    0
+#define O_WRONLY    1
+#define O_RDWR      2
 
 
 enum SYSCALL_NOS {
@@ -21,8 +33,26 @@ enum SYSCALL_NOS {
     SYS_SEEK,
     SYS_GPU_GET_DISPLAY_INFO,
     SYS_GPU_FILL,
-    SYS_GPU_FLUSH
+    SYS_GPU_FLUSH,
+    SYS_SET_PRIORITY,
+    SYS_SET_AFFINITY,
+    SYS_SET_SCHEDULER,
+    SYS_FUTEX_WAIT,
+    SYS_FUTEX_WAKE,
+    SYS_CLONE,
+    SYS_RING_SETUP,
+    SYS_RING_ENTER,
+    SYS_COUNT       // Not a syscall, keep it last
 };
 
 
+bool copy_to_user(void* dst, void* src, size_t n, ResourceControlBlock* rcb);
+bool copy_from_user(void* dst, void* src, size_t n, ResourceControlBlock* rcb);
+int syscall_open(ResourceControlBlock* rcb, uint64_t user_path, int flags);
+int syscall_close(ResourceControlBlock* rcb, int fd);
+int64_t syscall_read(ResourceControlBlock* rcb, int fd, uint64_t user_buf, size_t count);
+int64_t syscall_seek(ResourceControlBlock* rcb, int fd, int64_t offset, int whence);
+int syscall_stat(ResourceControlBlock* rcb, int fd, uint64_t user_stat);
+unsigned int syscall_get_events(VirtioInputEvent event_buffer[], unsigned int max_events, ResourceControlBlock* rcb);
+
 void syscall_handle(Process* process);
@@ -0,0 +1,57 @@
+#pragma once
+
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <hart.h>
+
+
+// Must be a power of 2
+#define TRACE_RING_SIZE         256
+
+// Bucket n counts latencies in [2^n, 2^(n+1)) ticks
+#define TRACE_HIST_BUCKETS      32
+
+
+typedef enum TraceEventType {
+    TE_SWITCH = 0,      // pid: next, arg: previous pid
+    TE_WAKEUP,          // pid: woken, arg: 0
+    TE_SLEEP,           // pid: sleeper, arg: 0
+    TE_MIGRATE          // pid: migrated, arg: hart it last ran on
+} TraceEventType;
+
+typedef struct TraceEvent {
+    uint64_t time;
+    uint16_t pid;
+    uint16_t arg;
+    uint8_t type;
+    uint8_t hart;       // Hart the event is about, not necessarily the one that recorded it
+} TraceEvent;
+
+typedef struct TraceHistogram {
+    uint64_t buckets[TRACE_HIST_BUCKETS];
+    uint64_t count;
+    uint64_t total;
+    uint64_t max;
+} TraceHistogram;
+
+// Only ever written by its own hart, so no locks. Readers check head
+// before and after copying to notice entries that got overwritten.
+typedef struct TraceBuffer {
+    TraceEvent ring[TRACE_RING_SIZE];
+    volatile uint64_t head;
+    TraceHistogram wait_hist;       // Time spent runnable but queued
+    TraceHistogram wakeup_hist;     // Time from wakeup to running
+} __attribute__((aligned(64))) TraceBuffer;
+
+
+extern TraceBuffer trace_buffers[NUM_HARTS];
+
+
+void trace_event(TraceEventType type, int hart, uint16_t pid, uint16_t arg);
+void trace_wait(uint64_t ticks);
+void trace_wakeup_latency(uint64_t ticks);
+bool trace_ring_lapped(volatile uint64_t* head, uint64_t i, uint64_t size);
+
+void trace_print();
+void trace_print_histograms();
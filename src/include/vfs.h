@@ -4,6 +4,13 @@
 #include <list.h>
 #include <virtio.h>
 #include <stddef.h>
+#include <stdint.h>
+#include <lock.h>
+
+
+#define VFS_SEEK_SET    0
+#define VFS_SEEK_CUR    1
+#define VFS_SEEK_END    2
 
 
 typedef enum VfsCacheNodeType {
@@ -20,9 +27,35 @@ typedef struct VfsCacheNode {
     VfsCacheNodeType type;
 } VfsCacheNode;
 
+// The path is only resolved once, when it's opened
+typedef struct OpenFile {
+    VfsCacheNode* mount;
+    void* node;             // The filesystem's own cache node for it
+    uint64_t position;
+    uint64_t size;
+    uint32_t mode;
+    int flags;
+    Mutex lock;             // Guards position
+    uint32_t refs;          // Dropped by vfs_close
+} OpenFile;
+
+typedef struct VfsStat {
+    uint64_t size;
+    uint32_t mode;
+    uint32_t type;          // VfsCacheNodeType of the filesystem it's on
+} VfsStat;
+
 
 bool vfs_init();
 VfsCacheNode* vfs_mount(VirtioDevice* block_device, char* path);
 VfsCacheNode* vfs_get_mount(char* path, char* path_left);
 size_t vfs_read_file(char* path, void* buf, size_t count);
 size_t vfs_get_filesize(char* path);
+
+OpenFile* vfs_open(char* path, int flags);
+size_t vfs_read(OpenFile* file, void* buf, size_t count);
+size_t vfs_read_at(OpenFile* file, void* buf, size_t count, uint64_t offset);
+uint64_t vfs_seek(OpenFile* file, int64_t offset, int whence);
+void vfs_stat(OpenFile* file, VfsStat* stat);
+void vfs_file_get(OpenFile* file);
+void vfs_close(OpenFile* file);
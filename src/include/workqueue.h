@@ -0,0 +1,44 @@
+#pragma once
+
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <lock.h>
+#include <hart.h>
+#include <process.h>
+
+
+// Embed one of these in whatever the work is about, so queueing never allocates
+typedef struct Work {
+    struct Work* next;
+    void (*func)(void*);
+    void* data;
+    bool pending;       // Queued and hasn't started running yet
+} Work;
+
+typedef struct WorkQueueStats {
+    uint64_t queued;
+    uint64_t run;
+    uint64_t run_inline;    // Queued before the worker existed, so ran right away
+    uint64_t wakeups;       // Times queueing had to wake the worker up
+} WorkQueueStats;
+
+// One per hart, each drained by a kernel thread pinned to that hart
+typedef struct WorkQueue {
+    Mutex lock;
+    Work* head;
+    Work* tail;
+    Process* worker;
+    WorkQueueStats stats;
+} __attribute__((aligned(64))) WorkQueue;
+
+
+extern WorkQueue work_queues[NUM_HARTS];
+
+
+bool workqueue_init();
+void work_prepare(Work* work, void (*func)(void*), void* data);
+bool workqueue_queue_on(int hart, Work* work);
+bool workqueue_queue(Work* work);
+
+void workqueue_print();
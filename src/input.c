@@ -16,6 +16,8 @@ VirtioDevice* virtio_input_tablet_device;
 VirtioInputEventRingBuffer virtio_input_event_ring_buffer;
 Mutex virtio_input_event_ring_buffer_lock;
 
+InputEventLog input_keyboard_log;
+
 
 // Just overwrite silently for now
 void virtio_input_event_push(VirtioInputEvent event) {
@@ -115,6 +117,42 @@ bool virtio_input_driver(volatile EcamHeader* ecam) {
 }
 
 
+// Printing takes far too long for an interrupt handler, so it happens in a worker
+void _input_keyboard_log_flush(void* data) {
+    InputEventLog* log;
+    VirtioInputEvent event;
+
+    log = data;
+
+    // The work can be requeued onto another worker while we're still going
+    mutex_sbi_lock(&log->lock);
+
+    while (log->tail != log->head) {
+        asm volatile("fence r, r" ::: "memory");
+        event = log->events[log->tail & (INPUT_KEYBOARD_LOG_SIZE - 1)];
+        log->tail++;
+
+        printf("input_keyboard_handle_irq: [KEYBOARD EVENT]: %02x/%02x/%08x\n", event.type, event.code, event.value);
+    }
+
+    mutex_unlock(&log->lock);
+}
+
+void _input_keyboard_log(VirtioInputEvent event) {
+    InputEventLog* log;
+
+    log = &input_keyboard_log;
+
+    if (log->head - log->tail >= INPUT_KEYBOARD_LOG_SIZE) {
+        log->dropped++;
+        return;
+    }
+
+    log->events[log->head & (INPUT_KEYBOARD_LOG_SIZE - 1)] = event;
+    asm volatile("fence w, w" ::: "memory");
+    log->head++;
+}
+
 void input_keyboard_handle_irq(VirtioDevice* virtio_input_keyboard_device) {
     VirtioInputDeviceInfo* keyboard_info;
     u16 ack_idx;
@@ -131,13 +169,15 @@ void input_keyboard_handle_irq(VirtioDevice* virtio_input_keyboard_device) {
         id = virtio_input_keyboard_device->queue_device->ring[ack_idx % queue_size].id;
         event = keyboard_info->event_buffer[id];
 
-        printf("input_keyboard_handle_irq: [KEYBOARD EVENT]: %02x/%02x/%08x\n", event.type, event.code, event.value);
+        _input_keyboard_log(event);
         virtio_input_event_push(event);
         
         virtio_input_keyboard_device->queue_driver->idx++;
 
         virtio_input_keyboard_device->ack_idx++;
     }
+
+    workqueue_queue(&input_keyboard_log.work);
 }
 
 void input_tablet_handle_irq(VirtioDevice* virtio_input_tablet_device) {
@@ -176,6 +216,9 @@ bool input_init() {
     u32 i;
     bool rv;
 
+    input_keyboard_log.lock = MUTEX_UNLOCKED;
+    work_prepare(&input_keyboard_log.work, _input_keyboard_log_flush, &input_keyboard_log);
+
     rv = true;
     for (it = virtio_input_device_head; it != NULL; it = it->next) {
         device = it->device;
@@ -0,0 +1,102 @@
+// kthread.c
+// Kernel threads: processes that run kernel code in S-mode on the kernel page table.
+// S-mode ecalls go to the SBI, so a kernel thread can't make syscalls. It gets off
+// the hart by raising SSIP on itself instead, which lands in c_trap like an IPI.
+//
+// Kernel threads run with interrupts off everywhere except inside kthread_yield
+// and kthread_preempt_point. They take the same locks trap handlers do (kmalloc,
+// run queues, ...), and a trap on the same hart would spin forever on a lock the
+// thread was holding.
+
+
+#include <kthread.h>
+#include <kmalloc.h>
+#include <page_alloc.h>
+#include <mmu.h>
+#include <csr.h>
+#include <spawn.h>
+#include <hartlocal.h>
+#include <rcu.h>
+#include <printf.h>
+#include <rs_int.h>
+
+
+// Make a new kernel thread that'll run func(data). It's not queued anywhere yet,
+// so set its affinity and whatnot and then schedule_add it.
+Process* kthread_new(void (*func)(void*), void* data) {
+    Process* thread;
+    void* stack;
+    u64 gp;
+
+    stack = page_zalloc(KTHREAD_STACK_PAGES);
+    if (stack == NULL) {
+        printf("kthread_new: stack page_zalloc failed\n");
+        return NULL;
+    }
+
+    thread = process_new();
+    thread->supervisor_mode = true;
+    thread->kernel_thread = true;
+    list_insert(thread->rcb->stack_pages, stack);
+
+    asm volatile("mv %0, gp" : "=r"(gp));
+
+    thread->frame.gpregs[XREG_SP] = (u64) stack + PS_4K * KTHREAD_STACK_PAGES;
+    thread->frame.gpregs[XREG_GP] = gp;
+    thread->frame.gpregs[XREG_RA] = (u64) kthread_exit;  // If func ever returns
+    thread->frame.gpregs[XREG_A0] = (u64) data;
+    thread->frame.sepc = (u64) func;
+
+    // No SPIE, so it starts with interrupts off
+    thread->frame.sstatus = SSTATUS_FS_INITIAL | SSTATUS_SPP_SUPERVISOR;
+    thread->frame.sie = SIE_SEIE | SIE_SSIE | SIE_STIE;
+    thread->frame.satp = SATP_MODE_SV39 | SATP_SET_ASID(KERNEL_ASID) | SATP_GET_PPN(kernel_mmu_table);
+    thread->frame.sscratch = (u64) &thread->frame;
+
+    thread->frame.stvec = process_trap_vector_addr;
+    thread->frame.trap_stack = 0;  // Set to the hart's trap stack by schedule_run
+
+    return thread;
+}
+
+// Gives up the hart. If the thread's state is still PS_RUNNING it goes back on
+// the run queue, otherwise it stays off until someone schedule_wakes it.
+void kthread_yield(void) {
+    // The interrupt is taken as soon as SIE goes on, and by the time we
+    // get back here we're running again, so turn them straight back off
+    asm volatile(
+        "csrs   sip, %0\n"
+        "csrs   sstatus, %1\n"
+        "csrc   sstatus, %1\n"
+        :: "r"(SIP_SSIP), "r"(SSTATUS_SIE) : "memory"
+    );
+}
+
+// Lets in whatever interrupts are pending, including the preemption timer, which
+// switches us out if our slice is up. Only call it while holding no locks.
+void kthread_preempt_point(void) {
+    asm volatile(
+        "csrs   sstatus, %0\n"
+        "csrc   sstatus, %0\n"
+        :: "r"(SSTATUS_SIE) : "memory"
+    );
+}
+
+void kthread_exit(void) {
+    HartLocal* hl;
+    Process* thread;
+
+    HARTLOCAL_GET(hl);
+    thread = hl->current_process;
+
+    thread->state = PS_DEAD;
+
+    // Same as SYS_EXIT. We're still standing on its stack, but not past the
+    // next quiescent state, which is the schedule_schedule this yield causes.
+    call_rcu((void (*)(void*)) process_free, thread);
+
+    kthread_yield();
+
+    printf("kthread_exit: pid %d came back from the dead\n", thread->pid);
+    WFI_LOOP();
+}
@@ -1,5 +1,6 @@
 #include <list.h>
 #include <kmalloc.h>
+#include <rcu.h>
 
 
 List* list_new() {
@@ -115,3 +116,22 @@ bool list_remove(List* list, void* data) {
     kfree(it);
     return true;
 }
+
+
+// Same as list_insert, but safe against concurrent lock-free readers.
+// Writers still have to serialize among themselves.
+ListNode* list_insert_rcu(List* list, void* data) {
+    ListNode* new_node;
+
+    new_node = kmalloc(sizeof(ListNode));
+    new_node->data = data;
+    new_node->next = list->head;
+
+    if (list->head == NULL) {
+        list->last = new_node;
+    }
+
+    RCU_ASSIGN_POINTER(list->head, new_node);
+
+    return new_node;
+}
@@ -15,6 +15,12 @@
 #include <vfs.h>
 #include <block.h>
 #include <rs_int.h>
+#include <hartlocal.h>
+#include <hrtimer.h>
+#include <workqueue.h>
+#include <futex.h>
+#include <osinfo.h>
+#include <strace.h>
 
 
 uint64_t OS_GPREGS[32];
@@ -39,6 +45,15 @@ void test_function(void) {
 int main(int hart) {
     CSR_WRITE("sscratch", OS_GPREGS);
 
+    hartlocal_init(hart);
+
+    if (!sbi_init()) {
+        printf("Failed to init sbi\n");
+        return 1;
+    }
+
+    printf("Timer: %s\n", sbi_has_sstc ? "stimecmp" : "sbi");
+
     if (!page_alloc_init()) {
         printf("Failed to init page_alloc\n");
         return 1;
@@ -54,6 +69,11 @@ int main(int hart) {
         return 1;
     }
 
+    if (!osinfo_init()) {
+        printf("Failed to init osinfo\n");
+        return 1;
+    }
+
     if (!pci_init()) {
         printf("Failed to init pci\n");
         return 1;
@@ -100,11 +120,31 @@ int main(int hart) {
         return 1;
     }
 
+    if (!strace_init()) {
+        printf("strace_init failed\n");
+        return 1;
+    }
+
+    if (!hrtimer_init()) {
+        printf("hrtimer_init failed\n");
+        return 1;
+    }
+
+    if (!futex_init()) {
+        printf("futex_init failed\n");
+        return 1;
+    }
+
     if (!schedule_init()) {
         printf("schedule_init failed\n");
         return 1;
     }
 
+    if (!workqueue_init()) {
+        printf("workqueue_init failed\n");
+        return 1;
+    }
+
     for (u32 i = 1; i < NUM_HARTS; i++) {
         schedule_schedule(i);
     }
@@ -262,7 +262,9 @@ Minix3CacheNode* minix3_get_file(VirtioDevice* block_device, char* path) {
     return current_cnode;
 }
 
-size_t minix3_read_zone(VirtioDevice* block_device, uint32_t zone, Minix3ZoneType type, void* buf, size_t count) {
+// Submits reads for every direct zone under zone without waiting for them.
+// Blocks of zone pointers are still read right away, since they say where to go next.
+size_t _minix3_read_zone(VirtioDevice* block_device, uint32_t zone, Minix3ZoneType type, void* buf, size_t count, BlockCompletion* completion) {
     Minix3SuperBlock* sb_ptr;
     Minix3SuperBlock minix3_sb;
     size_t num_read;
@@ -315,7 +317,7 @@ size_t minix3_read_zone(VirtioDevice* block_device, uint32_t zone, Minix3ZoneTyp
 
     // If direct, just read and return
     if (type == Z_DIRECT) {
-        if (!block_read_poll(block_device, buf, zone_addr, count)) {
+        if (!block_submit(block_device, VIRTIO_BLK_T_IN, buf, zone_addr, count, completion)) {
             return -1UL;
         }
 
@@ -338,7 +340,7 @@ size_t minix3_read_zone(VirtioDevice* block_device, uint32_t zone, Minix3ZoneTyp
             continue;
         }
 
-        num_read = minix3_read_zone(block_device, block[i], type - 1, buf + total_read, count - total_read);
+        num_read = _minix3_read_zone(block_device, block[i], type - 1, buf + total_read, count - total_read, completion);
         if (num_read == -1UL) {
             kfree(block);
             return -1UL;
@@ -355,6 +357,22 @@ size_t minix3_read_zone(VirtioDevice* block_device, uint32_t zone, Minix3ZoneTyp
     return total_read;
 }
 
+size_t minix3_read_zone(VirtioDevice* block_device, uint32_t zone, Minix3ZoneType type, void* buf, size_t count) {
+    BlockCompletion completion;
+    size_t num_read;
+
+    block_completion_init(&completion, NULL, NULL);
+
+    num_read = _minix3_read_zone(block_device, zone, type, buf, count, &completion);
+
+    // Whatever did get submitted still points into buf, so wait even if something failed
+    if (!block_wait(&completion) || num_read == -1UL) {
+        return -1UL;
+    }
+
+    return num_read;
+}
+
 size_t minix3_read_file(VirtioDevice* block_device, char* path, void* buf, size_t count) {
     Minix3SuperBlock* sb_ptr;
     Minix3SuperBlock minix3_sb;
@@ -364,6 +382,7 @@ size_t minix3_read_file(VirtioDevice* block_device, char* path, void* buf, size_
     size_t zone_count;
     size_t num_read;
     size_t total_read;
+    BlockCompletion completion;
     u32 i;
 
     sb_ptr = map_get(minix3_superblocks, (u64) block_device);
@@ -383,6 +402,8 @@ size_t minix3_read_file(VirtioDevice* block_device, char* path, void* buf, size_
         count = cnode->inode.size;
     }
 
+    block_completion_init(&completion, NULL, NULL);
+
     total_read = 0;
     for (i = 0; i < MINIX3_ZONES_PER_INODE; i++) {
         zone = cnode->inode.zones[i];
@@ -423,8 +444,9 @@ size_t minix3_read_file(VirtioDevice* block_device, char* path, void* buf, size_
             zone_count = count - total_read;
         }
 
-        num_read = minix3_read_zone(block_device, zone, type, buf + total_read, zone_count);
+        num_read = _minix3_read_zone(block_device, zone, type, buf + total_read, zone_count, &completion);
         if (num_read == -1UL) {
+            block_wait(&completion);
             return -1UL;
         }
 
@@ -435,9 +457,162 @@ size_t minix3_read_file(VirtioDevice* block_device, char* path, void* buf, size_
         }
     }
 
+    if (!block_wait(&completion)) {
+        return -1UL;
+    }
+
     return total_read;
 }
 
+// Remembers the last block of zone pointers read at each level of indirection,
+// since reading a file in order looks up the same ones over and over.
+// Level 0 is the block the inode points at.
+typedef struct Minix3PointerCache {
+    u32 zone[MINIX3_POINTER_LEVELS];
+    u32* block[MINIX3_POINTER_LEVELS];
+} Minix3PointerCache;
+
+u32 _minix3_read_pointer(VirtioDevice* block_device, Minix3SuperBlock* sb, Minix3PointerCache* cache, u32 level, u32 zone, u64 index) {
+    if (zone == 0) {
+        return 0;
+    }
+
+    if (cache->zone[level] != zone) {
+        if (!block_read_poll(block_device, cache->block[level], GET_ZONE_ADDR(zone, (*sb)), sb->block_size)) {
+            cache->zone[level] = 0;
+            return -1U;
+        }
+
+        cache->zone[level] = zone;
+    }
+
+    return cache->block[level][index];
+}
+
+// Zone holding the index'th block of the file. 0 for a hole, -1U if a read failed.
+u32 _minix3_bmap(VirtioDevice* block_device, Minix3SuperBlock* sb, Minix3PointerCache* cache, Minix3Inode* inode, u64 index) {
+    u64 per_block;
+    u32 zone;
+
+    per_block = sb->block_size / sizeof(u32);
+
+    if (index < 7) {
+        return inode->zones[index];
+    }
+
+    index -= 7;
+    if (index < per_block) {
+        return _minix3_read_pointer(block_device, sb, cache, 0, inode->zones[7], index);
+    }
+
+    index -= per_block;
+    if (index < per_block * per_block) {
+        zone = _minix3_read_pointer(block_device, sb, cache, 0, inode->zones[8], index / per_block);
+        if (zone == -1U) {
+            return -1U;
+        }
+
+        return _minix3_read_pointer(block_device, sb, cache, 1, zone, index % per_block);
+    }
+
+    index -= per_block * per_block;
+    zone = _minix3_read_pointer(block_device, sb, cache, 0, inode->zones[9], index / (per_block * per_block));
+    if (zone == -1U) {
+        return -1U;
+    }
+
+    zone = _minix3_read_pointer(block_device, sb, cache, 1, zone, index / per_block % per_block);
+    if (zone == -1U) {
+        return -1U;
+    }
+
+    return _minix3_read_pointer(block_device, sb, cache, 2, zone, index % per_block);
+}
+
+// Reads up to count bytes starting offset bytes into the file.
+// Runs of consecutive zones go to the disk as one read.
+size_t minix3_read_at(VirtioDevice* block_device, Minix3CacheNode* cnode, void* buf, size_t count, uint64_t offset) {
+    Minix3SuperBlock* sb_ptr;
+    Minix3SuperBlock minix3_sb;
+    Minix3PointerCache cache;
+    BlockCompletion completion;
+    u32 level;
+    u64 block_size;
+    u64 pos;
+    u64 end;
+    u64 run;
+    u32 zone;
+    u32 next_zone;
+
+    sb_ptr = map_get(minix3_superblocks, (u64) block_device);
+    if (sb_ptr == NULL) {
+        printf("minix3_read_at: no superblock for block device: 0x%08lx\n", (u64) block_device);
+        return -1UL;
+    }
+
+    minix3_sb = *sb_ptr;
+    block_size = minix3_sb.block_size;
+
+    if (offset >= cnode->inode.size) {
+        return 0;
+    }
+
+    if (count > cnode->inode.size - offset) {
+        count = cnode->inode.size - offset;
+    }
+
+    for (level = 0; level < MINIX3_POINTER_LEVELS; level++) {
+        cache.zone[level] = 0;
+        cache.block[level] = kmalloc(block_size);
+    }
+
+    // Every run gets submitted before waiting on any of them
+    block_completion_init(&completion, NULL, NULL);
+
+    pos = offset;
+    end = offset + count;
+    while (pos < end) {
+        zone = _minix3_bmap(block_device, &minix3_sb, &cache, &cnode->inode, pos / block_size);
+        if (zone == -1U) {
+            break;
+        }
+
+        // Stretch the read over every zone that follows this one on disk
+        run = block_size - pos % block_size;
+        while (pos + run < end && zone != 0) {
+            next_zone = _minix3_bmap(block_device, &minix3_sb, &cache, &cnode->inode, (pos + run) / block_size);
+            if (next_zone != zone + (pos + run) / block_size - pos / block_size) {
+                break;
+            }
+
+            run += block_size;
+        }
+
+        if (run > end - pos) {
+            run = end - pos;
+        }
+
+        if (zone == 0) {
+            memset(buf + (pos - offset), 0, run);
+        } else if (!block_submit(block_device, VIRTIO_BLK_T_IN, buf + (pos - offset), GET_ZONE_ADDR(zone, minix3_sb) + pos % block_size, run, &completion)) {
+            break;
+        }
+
+        pos += run;
+    }
+
+    for (level = 0; level < MINIX3_POINTER_LEVELS; level++) {
+        kfree(cache.block[level]);
+    }
+
+    // Whatever did get submitted still points into buf, so wait even if something failed
+    if (!block_wait(&completion) || pos < end) {
+        return -1UL;
+    }
+
+    return count;
+}
+
 size_t minix3_get_filesize(VirtioDevice* block_device, char* path) {
     Minix3CacheNode* cnode;
 
@@ -37,6 +37,17 @@ bool mmu_map(PageTable* tb, uint64_t vaddr, uint64_t paddr, uint64_t bits) {
 
     bits &= 0xFF;
 
+    // Kernel mappings are the same in every address space, except for the
+    // private slot, which process tables never get
+    if (tb == kernel_mmu_table) {
+        if (((vaddr >> 30) & 0x1FF) != MMU_KERNEL_PRIVATE_SLOT) {
+            bits |= PB_GLOBAL;
+        }
+    } else if (mmu_is_shared(tb, vaddr)) {
+        printf("mmu_map: 0x%lx is in the kernel's part of the address space\n", vaddr);
+        return false;
+    }
+
     vpn[0] = (vaddr >> 12) & 0x1FF;
     vpn[1] = (vaddr >> 21) & 0x1FF;
     vpn[2] = (vaddr >> 30) & 0x1FF;
@@ -88,7 +99,7 @@ bool mmu_map_many(PageTable* tb, uint64_t vaddr_start, uint64_t paddr_start, uin
     return true;
 }
 
-void mmu_free(PageTable* tb) {
+void _mmu_free_table(PageTable* tb) {
     uint64_t entry;
     PageTable* next_tb;
     int i;
@@ -101,13 +112,49 @@ void mmu_free(PageTable* tb) {
             tb->entries[i] = entry & ~PB_VALID;
         } else { // Branch
             next_tb = (PageTable*) ((entry << 2) & 0xFFFFFFFFFFF000UL);
-            mmu_free(next_tb);
+            _mmu_free_table(next_tb);
         }
     }
 
     page_dealloc(tb);
 }
 
+// Frees a process's table, leaving the kernel's shared tables alone
+void mmu_free(PageTable* tb) {
+    int i;
+
+    for (i = 0; i < 512; i++) {
+        if (mmu_is_shared(tb, (uint64_t) i << 30)) {
+            tb->entries[i] = 0;
+        }
+    }
+
+    _mmu_free_table(tb);
+}
+
+// Points tb's top level entries at the kernel's own lower level tables, so every
+// address space has the kernel mapped and traps don't have to switch satp.
+// Only slots the kernel is already using get shared, so it mustn't start using
+// a new gigabyte once processes exist.
+void mmu_share_kernel(PageTable* tb) {
+    int i;
+
+    for (i = 0; i < 512; i++) {
+        if (i != MMU_KERNEL_PRIVATE_SLOT && (kernel_mmu_table->entries[i] & PB_VALID)) {
+            tb->entries[i] = kernel_mmu_table->entries[i];
+        }
+    }
+}
+
+// True if vaddr falls in a slot tb shares with the kernel's table
+bool mmu_is_shared(PageTable* tb, uint64_t vaddr) {
+    uint64_t entry;
+
+    entry = tb->entries[(vaddr >> 30) & 0x1FF];
+
+    return tb != kernel_mmu_table && (entry & PB_VALID) && entry == kernel_mmu_table->entries[(vaddr >> 30) & 0x1FF];
+}
+
 uint64_t mmu_translate(PageTable* tb, uint64_t vaddr) {
     uint32_t vpn[3];
     uint64_t paddr_chunks[3];
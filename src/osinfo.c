@@ -0,0 +1,92 @@
+// osinfo.c
+// Pages of rarely changing kernel state that every process can read without
+// a syscall. The kernel is the only writer and guards updates with a seqlock.
+
+
+#include <osinfo.h>
+#include <page_alloc.h>
+#include <mmu.h>
+#include <sbi.h>
+#include <hart.h>
+#include <printf.h>
+#include <rs_int.h>
+
+
+OsInfo* os_info;
+Mutex os_info_lock = MUTEX_UNLOCKED;
+
+
+void _osinfo_write_begin() {
+    mutex_sbi_lock(&os_info_lock);
+
+    os_info->seq++;
+    asm volatile("fence w, w" ::: "memory");
+}
+
+void _osinfo_write_end() {
+    asm volatile("fence w, w" ::: "memory");
+    os_info->seq++;
+
+    mutex_unlock(&os_info_lock);
+}
+
+
+bool osinfo_init() {
+    os_info = page_zalloc(1);
+    if (os_info == NULL) {
+        printf("osinfo_init: page_zalloc failed\n");
+        return false;
+    }
+
+    _osinfo_write_begin();
+
+    os_info->num_harts = NUM_HARTS;
+    os_info->time_base = sbi_get_time();
+    os_info->ticks_per_sec = OSINFO_TIMEBASE_HZ;
+
+    _osinfo_write_end();
+
+    return true;
+}
+
+void osinfo_set_display(uint32_t scanout_id, VirtioGpuRectangle rect, bool enabled) {
+    if (os_info == NULL || scanout_id >= VIRTIO_GPU_MAX_SCANOUTS) {
+        return;
+    }
+
+    _osinfo_write_begin();
+
+    os_info->displays[scanout_id].rect = rect;
+    os_info->displays[scanout_id].enabled = enabled;
+
+    _osinfo_write_end();
+}
+
+// Maps the shared page and a new per-process page into tb.
+// The new page goes on pages so it's freed with the rest of the process.
+bool osinfo_map(PageTable* tb, uint16_t pid, List* pages, uint64_t user_flag) {
+    OsProcessInfo* process_info;
+
+    if (!mmu_map(tb, OSINFO_VADDR, mmu_translate(kernel_mmu_table, (u64) os_info), user_flag | PB_READ)) {
+        printf("osinfo_map: mmu_map failed\n");
+        return false;
+    }
+
+    process_info = page_zalloc(1);
+    if (process_info == NULL) {
+        printf("osinfo_map: page_zalloc failed\n");
+        return false;
+    }
+
+    process_info->pid = pid;
+
+    if (!mmu_map(tb, OSINFO_PROCESS_VADDR, mmu_translate(kernel_mmu_table, (u64) process_info), user_flag | PB_READ)) {
+        printf("osinfo_map: mmu_map failed\n");
+        page_dealloc(process_info);
+        return false;
+    }
+
+    list_insert(pages, process_info);
+
+    return true;
+}
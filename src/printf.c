@@ -142,6 +142,41 @@ static inline void _out_null(char character, void *buffer, size_t idx, size_t ma
     (void)maxlen;
 }
 
+// printf and vprintf_ collect output here and hand it to the SBI
+// a chunk at a time, instead of trapping once per character
+#define PRINTF_OUT_BUFFER_SIZE 128U
+
+typedef struct
+{
+    char buffer[PRINTF_OUT_BUFFER_SIZE];
+    size_t len;
+} out_console_type;
+
+static inline void _out_console_flush(out_console_type *console)
+{
+    if (console->len > 0)
+    {
+        sbi_putstring(console->buffer, console->len);
+        console->len = 0;
+    }
+}
+
+// internal buffered console output
+static inline void _out_console(char character, void *buffer, size_t idx, size_t maxlen)
+{
+    out_console_type *console = (out_console_type *)buffer;
+    (void)idx;
+    (void)maxlen;
+    if (character)
+    {
+        console->buffer[console->len++] = character;
+        if (console->len == PRINTF_OUT_BUFFER_SIZE)
+        {
+            _out_console_flush(console);
+        }
+    }
+}
+
 // internal _putchar wrapper
 static inline void _out_char(char character, void *buffer, size_t idx, size_t maxlen)
 {
@@ -995,8 +1030,10 @@ int printf(const char *format, ...)
 {
     va_list va;
     va_start(va, format);
-    char buffer[1];
-    const int ret = _vsnprintf(_out_char, buffer, (size_t)-1, format, va);
+    out_console_type console;
+    console.len = 0;
+    const int ret = _vsnprintf(_out_console, (char *)&console, (size_t)-1, format, va);
+    _out_console_flush(&console);
     va_end(va);
     return ret;
 }
@@ -1021,8 +1058,11 @@ int snprintf(char *buffer, size_t count, const char *format, ...)
 
 int vprintf_(const char *format, va_list va)
 {
-    char buffer[1];
-    return _vsnprintf(_out_char, buffer, (size_t)-1, format, va);
+    out_console_type console;
+    console.len = 0;
+    const int ret = _vsnprintf(_out_console, (char *)&console, (size_t)-1, format, va);
+    _out_console_flush(&console);
+    return ret;
 }
 
 int vsnprintf_(char *buffer, size_t count, const char *format, va_list va)
@@ -12,10 +12,18 @@
 #include <vfs.h>
 #include <rs_int.h>
 #include <printf.h>
+#include <hartlocal.h>
+#include <osinfo.h>
+#include <ring.h>
 
 
 Bitset* used_pids;
 uint16_t avail_pid;
+Mutex pid_lock;     // clone on any hart and exec on the console can want a pid at once
+
+// Bumped every time an ASID is released. Harts flush their whole TLB
+// before running anything if it's moved since they last looked.
+uint32_t process_asid_generation;
 
 
 bool process_init() {
@@ -24,159 +32,295 @@ bool process_init() {
     bitset_insert(used_pids, PROCESS_KERNEL_PID);
 
     avail_pid = 1;
+    pid_lock = MUTEX_UNLOCKED;
 
     return true;
 }
 
 uint16_t get_avail_pid() {
     uint16_t rv;
-    
+
+    mutex_sbi_lock(&pid_lock);
+
     while (bitset_find(used_pids, avail_pid)) {
         avail_pid++;
     }
 
     rv = avail_pid;
     avail_pid++;
+    bitset_insert(used_pids, rv);
+
+    mutex_unlock(&pid_lock);
 
     return rv;
 }
 
-Process* process_new() {
+void process_release_pid(uint16_t pid) {
+    mutex_sbi_lock(&pid_lock);
+    bitset_remove(used_pids, pid);
+    mutex_unlock(&pid_lock);
+}
+
+// Everything but the resources, which are either new or shared
+Process* _process_alloc() {
     Process* p;
 
     p = kzalloc(sizeof(Process));
-    p->rcb.image_pages = list_new();
-    p->rcb.stack_pages = list_new();
-    p->rcb.heap_pages = list_new();
-    p->rcb.file_descriptors = list_new();
-    p->rcb.ptable = page_zalloc(1);
 
     p->quantum = PROCESS_DEFAULT_QUANTUM;
+    p->nice = 0;
+    p->policy = SP_NORMAL;
+    p->weight = PROCESS_NICE_0_WEIGHT;
     p->pid = get_avail_pid();
     p->on_hart = -1;
+    p->rq_hart = -1;
+    p->last_hart = -1;
+    p->fp_hart = -1;
+    p->affinity = PROCESS_AFFINITY_ALL;
+
+    // Unarmed until someone starts them. Cancelling one that never ran has to be a no-op.
+    hrtimer_prepare(&p->sleep_timer, NULL, p);
+    hrtimer_prepare(&p->rt_timer, NULL, p);
 
     return p;
 }
 
-void process_free(Process* process) {
+Process* process_new() {
+    Process* p;
+
+    p = _process_alloc();
+    p->tgid = p->pid;
+
+    p->rcb = kzalloc(sizeof(ResourceControlBlock));
+    p->rcb->image_pages = list_new();
+    p->rcb->stack_pages = list_new();
+    p->rcb->heap_pages = list_new();
+    p->rcb->file_descriptors = list_new();
+    p->rcb->ptable = page_zalloc(1);
+    mmu_share_kernel(p->rcb->ptable);
+    p->rcb->lock = MUTEX_UNLOCKED;
+    p->rcb->refs = 1;
+    p->rcb->next_stack = 1;     // process_prepare maps slot 0
+    p->rcb->next_fd = 3;        // Leave the usual three free
+    p->rcb->asid = p->tgid;
+
+    return p;
+}
+
+void _process_free_rcb(ResourceControlBlock* rcb) {
     ListNode* it;
 
-    for (it = process->rcb.image_pages->head; it != NULL; it = it->next) {
+    for (it = rcb->image_pages->head; it != NULL; it = it->next) {
         page_dealloc(it->data);
     }
 
-    for (it = process->rcb.stack_pages->head; it != NULL; it = it->next) {
+    for (it = rcb->stack_pages->head; it != NULL; it = it->next) {
         page_dealloc(it->data);
     }
 
-    for (it = process->rcb.heap_pages->head; it != NULL; it = it->next) {
+    for (it = rcb->heap_pages->head; it != NULL; it = it->next) {
         page_dealloc(it->data);
     }
 
-    for (it = process->rcb.file_descriptors->head; it != NULL; it = it->next) {
+    for (it = rcb->file_descriptors->head; it != NULL; it = it->next) {
+        vfs_close(((FileDescriptor*) it->data)->file);
         kfree(it->data);
     }
 
-    list_free(process->rcb.image_pages);
-    list_free(process->rcb.stack_pages);
-    list_free(process->rcb.heap_pages);
-    list_free(process->rcb.file_descriptors);
+    list_free(rcb->image_pages);
+    list_free(rcb->stack_pages);
+    list_free(rcb->heap_pages);
+    list_free(rcb->file_descriptors);
+
+    if (rcb->ring != NULL) {
+        ring_free(rcb->ring);
+    }
+
+    mmu_free(rcb->ptable);
+
+    // Other harts can still have its translations cached under this ASID.
+    // The generation has to move before someone else can be handed it.
+    SFENCE_ASID(rcb->asid);
+    asm volatile("amoadd.w zero, %0, (%1)" :: "r"(1), "r"(&process_asid_generation) : "memory");
+    process_release_pid(rcb->asid);
+
+    kfree(rcb);
+}
+
+// For things besides its threads that need the process's memory to stick around
+void process_rcb_get(ResourceControlBlock* rcb) {
+    asm volatile("amoadd.w zero, %0, (%1)" :: "r"(1), "r"(&rcb->refs) : "memory");
+}
+
+void process_rcb_put(ResourceControlBlock* rcb) {
+    u32 refs;
+
+    asm volatile("amoadd.w %0, %1, (%2)" : "=r"(refs) : "r"(-1), "r"(&rcb->refs) : "memory");
+    if (refs == 1) {
+        _process_free_rcb(rcb);
+    }
+}
+
+// Threads' stacks stay mapped until the whole process goes away
+void process_free(Process* process) {
+    u32 i;
 
-    mmu_free(process->rcb.ptable);
+    // Something else could get allocated here and look like it owns them.
+    // Clearing a hart's owner is always safe, it just costs a lazy restore.
+    for (i = 0; i < NUM_HARTS; i++) {
+        if (hart_locals[i].fp_owner == process) {
+            hart_locals[i].fp_owner = NULL;
+        }
+    }
+
+    // The main thread's pid is the ASID, which goes with the rcb
+    if (process->pid != process->rcb->asid) {
+        process_release_pid(process->pid);
+    }
+
+    process_rcb_put(process->rcb);
 
     kfree(process);
 }
 
 
+// Frame setup shared by process_prepare and process_clone. Leaves the gpregs and sepc alone.
+void _process_prepare_frame(Process* process) {
+    process->frame.sstatus = SSTATUS_FS_INITIAL | SSTATUS_SPIE;
+    if (process->supervisor_mode) {
+        process->frame.sstatus |= SSTATUS_SPP_SUPERVISOR;
+    } else {
+        process->frame.sstatus |= SSTATUS_SPP_USER;
+    }
+
+    // Threads share an ASID, since they share the page table it tags
+    process->frame.sie = SIE_SEIE | SIE_SSIE | SIE_STIE;
+    process->frame.satp = SATP_MODE_SV39 | SATP_SET_ASID(process->tgid) | SATP_GET_PPN(mmu_translate(kernel_mmu_table, (u64) process->rcb->ptable));
+    process->frame.sscratch = (u64) &process->frame;
+    
+    process->frame.stvec = process_trap_vector_addr;
+    process->frame.trap_stack = 0;  // Set to the hart's trap stack by schedule_run
+}
+
 bool process_prepare(Process* process) {
     void* stack;
-    void* trap_stack;
     u64 user_flag;
-    
-    // Map process spawn function
-    if (!mmu_map_many(
-        process->rcb.ptable,
-        process_spawn_addr,
-        mmu_translate(kernel_mmu_table, process_spawn_addr),
-        (u64) process_spawn_size,
-        PB_EXECUTE
-    )) {
-        printf("process_prepare: process spawn mmu_map_many failed\n");
-        return false;
-    }
 
-    // Map process trap vector
-    if (!mmu_map_many(
-        process->rcb.ptable,
-        process_trap_vector_addr,
-        mmu_translate(kernel_mmu_table, process_trap_vector_addr),
-        (u64) process_trap_vector_size,
-        PB_EXECUTE
-    )) {
-        printf("process_prepare: process trap vector mmu_map_many failed\n");
-        return false;
+    // The spawn code, trap vector and frame are all in the kernel's shared mappings
+
+    stack = page_zalloc(PROCESS_DEFAULT_STACK_PAGES);
+    user_flag = 0;
+    if (!process->supervisor_mode) {
+        user_flag |= PB_USER;
     }
 
-    // Map process frame
+    // Map process stack
     if (
         !mmu_map_many(
-            process->rcb.ptable,
-            (u64) &process->frame,
-            mmu_translate(kernel_mmu_table, (u64) &process->frame),
-            sizeof(ProcFrame),
-            PB_READ | PB_WRITE
+            process->rcb->ptable,
+            PROCESS_DEFAULT_STACK_VADDR,
+            mmu_translate(kernel_mmu_table, (u64) stack),
+            PS_4K * PROCESS_DEFAULT_STACK_PAGES,
+            user_flag | PB_READ | PB_WRITE
         )
     ) {
-        printf("process_prepare: process frame mmu_map_many failed\n");
+        printf("process_prepare: stack mmu_map failed\n");
+        page_dealloc(stack);
         return false;
     }
 
+    list_insert(process->rcb->stack_pages, stack);
+
+    if (!osinfo_map(process->rcb->ptable, process->tgid, process->rcb->heap_pages, user_flag)) {
+        printf("process_prepare: osinfo_map failed\n");
+        return false;
+    }
+
+    _process_prepare_frame(process);
+    process->frame.gpregs[XREG_SP] = PROCESS_DEFAULT_STACK_VADDR + PS_4K * PROCESS_DEFAULT_STACK_PAGES;
+
+    SFENCE_ASID(process->tgid);
+
+    return true;
+}
+
+// Makes a new thread in parent's process. It gets its own frame and stack but
+// shares everything else, and starts at entry with a0 and a1 as arguments.
+// It isn't scheduled yet.
+Process* process_clone(Process* parent, uint64_t entry, uint64_t a0, uint64_t a1) {
+    ResourceControlBlock* rcb;
+    Process* thread;
+    void* stack;
+    u64 stack_vaddr;
+    u64 user_flag;
+    u32 slot;
+
+    rcb = parent->rcb;
+
+    mutex_sbi_lock(&rcb->lock);
+
+    if (rcb->next_stack >= PROCESS_MAX_THREADS) {
+        mutex_unlock(&rcb->lock);
+        printf("process_clone: pid %d has too many threads\n", parent->tgid);
+        return NULL;
+    }
+
+    slot = rcb->next_stack;
+    rcb->next_stack++;
+
+    mutex_unlock(&rcb->lock);
+
     stack = page_zalloc(PROCESS_DEFAULT_STACK_PAGES);
+    if (stack == NULL) {
+        printf("process_clone: stack page_zalloc failed\n");
+        return NULL;
+    }
+
     user_flag = 0;
-    if (!process->supervisor_mode) {
+    if (!parent->supervisor_mode) {
         user_flag |= PB_USER;
     }
 
-    // Map process stack
+    stack_vaddr = PROCESS_STACK_VADDR(slot);
     if (
         !mmu_map_many(
-            process->rcb.ptable,
-            PROCESS_DEFAULT_STACK_VADDR,
+            rcb->ptable,
+            stack_vaddr,
             mmu_translate(kernel_mmu_table, (u64) stack),
             PS_4K * PROCESS_DEFAULT_STACK_PAGES,
             user_flag | PB_READ | PB_WRITE
         )
     ) {
-        printf("process_prepare: stack mmu_map failed\n");
+        printf("process_clone: stack mmu_map failed\n");
         page_dealloc(stack);
-        return false;
+        return NULL;
     }
 
-    trap_stack = page_zalloc(PROCESS_DEFAULT_TRAP_STACK_PAGES);
+    thread = _process_alloc();
+    thread->tgid = parent->tgid;
+    thread->supervisor_mode = parent->supervisor_mode;
+    thread->nice = parent->nice;
+    thread->weight = parent->weight;
+    thread->affinity = parent->affinity;
+    thread->state = PS_RUNNING;
 
-    list_insert(process->rcb.stack_pages, stack);
-    list_insert(process->rcb.stack_pages, trap_stack);
+    asm volatile("amoadd.w zero, %0, (%1)" :: "r"(1), "r"(&rcb->refs));
+    thread->rcb = rcb;
 
-    process->frame.sstatus = SSTATUS_FS_INITIAL | SSTATUS_SPIE;
-    if (process->supervisor_mode) {
-        process->frame.sstatus |= SSTATUS_SPP_SUPERVISOR;
-    } else {
-        process->frame.sstatus |= SSTATUS_SPP_USER;
-    }
+    mutex_sbi_lock(&rcb->lock);
+    list_insert(rcb->stack_pages, stack);
+    mutex_unlock(&rcb->lock);
 
-    process->frame.gpregs[XREG_SP] = PROCESS_DEFAULT_STACK_VADDR + PS_4K * PROCESS_DEFAULT_STACK_PAGES;
+    _process_prepare_frame(thread);
+    thread->frame.gpregs[XREG_SP] = stack_vaddr + PS_4K * PROCESS_DEFAULT_STACK_PAGES;
+    thread->frame.gpregs[XREG_GP] = parent->frame.gpregs[XREG_GP];
+    thread->frame.gpregs[XREG_A0] = a0;
+    thread->frame.gpregs[XREG_A1] = a1;
+    thread->frame.sepc = entry;
 
-    process->frame.sie = SIE_SEIE | SIE_SSIE | SIE_STIE;
-    process->frame.satp = SATP_MODE_SV39 | SATP_SET_ASID(process->pid) | SATP_GET_PPN(mmu_translate(kernel_mmu_table, (u64) process->rcb.ptable));
-    process->frame.sscratch = (u64) &process->frame;
-    
-    process->frame.stvec = process_trap_vector_addr;
-    process->frame.trap_satp = SATP_MODE_SV39 | SATP_SET_ASID(KERNEL_ASID) | SATP_GET_PPN(kernel_mmu_table);
-    process->frame.trap_stack = (u64) trap_stack + PS_4K * PROCESS_DEFAULT_TRAP_STACK_PAGES;
-
-    SFENCE_ASID(process->pid);
+    SFENCE_ASID(thread->tgid);
 
-    return true;
+    return thread;
 }
 
 
@@ -289,7 +433,7 @@ bool process_load_elf(Process* process, char* path) {
         );
 
         for (j = 0; j < (program_header.p_memsz + PS_4K - 1) / PS_4K; j++) {
-            flags = mmu_flags(process->rcb.ptable, program_header.p_vaddr + j * PS_4K) | user_flag;
+            flags = mmu_flags(process->rcb->ptable, program_header.p_vaddr + j * PS_4K) | user_flag;
 
             if (program_header.p_flags & PF_R) {
                 flags |= PB_READ;
@@ -304,7 +448,7 @@ bool process_load_elf(Process* process, char* path) {
             }
 
             if (!mmu_map_many(
-                process->rcb.ptable,
+                process->rcb->ptable,
                 program_header.p_vaddr + j * PS_4K,
                 (u64) image + (program_header.p_vaddr - load_addr_start) + j * PS_4K,
                 program_header.p_memsz,
@@ -320,7 +464,7 @@ bool process_load_elf(Process* process, char* path) {
     }
 
     // Add image to process
-    list_insert(process->rcb.image_pages, image);
+    list_insert(process->rcb->image_pages, image);
 
     process->frame.sepc = elf_header.e_entry;
 
@@ -0,0 +1,348 @@
+// rbtree.c
+// Intrusive red-black tree. Nodes live inside the objects being sorted,
+// so inserting and removing never allocates.
+
+
+#include <rbtree.h>
+
+
+void rbtree_init(RbTree* tree, bool (*less)(RbNode* a, RbNode* b)) {
+    tree->root = NULL;
+    tree->leftmost = NULL;
+    tree->less = less;
+}
+
+void _rbtree_rotate_left(RbTree* tree, RbNode* node) {
+    RbNode* right;
+
+    right = node->right;
+
+    node->right = right->left;
+    if (right->left != NULL) {
+        right->left->parent = node;
+    }
+
+    right->parent = node->parent;
+    if (node->parent == NULL) {
+        tree->root = right;
+    } else if (node == node->parent->left) {
+        node->parent->left = right;
+    } else {
+        node->parent->right = right;
+    }
+
+    right->left = node;
+    node->parent = right;
+}
+
+void _rbtree_rotate_right(RbTree* tree, RbNode* node) {
+    RbNode* left;
+
+    left = node->left;
+
+    node->left = left->right;
+    if (left->right != NULL) {
+        left->right->parent = node;
+    }
+
+    left->parent = node->parent;
+    if (node->parent == NULL) {
+        tree->root = left;
+    } else if (node == node->parent->right) {
+        node->parent->right = left;
+    } else {
+        node->parent->left = left;
+    }
+
+    left->right = node;
+    node->parent = left;
+}
+
+void rbtree_insert(RbTree* tree, RbNode* node) {
+    RbNode* parent;
+    RbNode* grandparent;
+    RbNode* uncle;
+    RbNode* it;
+    bool is_leftmost;
+
+    node->left = NULL;
+    node->right = NULL;
+    node->color = RB_RED;
+
+    // Plain BST insert first. Equal keys go right so insertion order is kept.
+    parent = NULL;
+    it = tree->root;
+    is_leftmost = true;
+    while (it != NULL) {
+        parent = it;
+        if (tree->less(node, it)) {
+            it = it->left;
+        } else {
+            it = it->right;
+            is_leftmost = false;
+        }
+    }
+
+    node->parent = parent;
+    if (parent == NULL) {
+        tree->root = node;
+    } else if (tree->less(node, parent)) {
+        parent->left = node;
+    } else {
+        parent->right = node;
+    }
+
+    if (is_leftmost) {
+        tree->leftmost = node;
+    }
+
+    // Fix red-red violations on the way up
+    while ((parent = node->parent) != NULL && parent->color == RB_RED) {
+        grandparent = parent->parent;
+
+        if (parent == grandparent->left) {
+            uncle = grandparent->right;
+            if (uncle != NULL && uncle->color == RB_RED) {
+                parent->color = RB_BLACK;
+                uncle->color = RB_BLACK;
+                grandparent->color = RB_RED;
+                node = grandparent;
+                continue;
+            }
+
+            if (node == parent->right) {
+                _rbtree_rotate_left(tree, parent);
+                node = parent;
+                parent = node->parent;
+            }
+
+            parent->color = RB_BLACK;
+            grandparent->color = RB_RED;
+            _rbtree_rotate_right(tree, grandparent);
+        } else {
+            uncle = grandparent->left;
+            if (uncle != NULL && uncle->color == RB_RED) {
+                parent->color = RB_BLACK;
+                uncle->color = RB_BLACK;
+                grandparent->color = RB_RED;
+                node = grandparent;
+                continue;
+            }
+
+            if (node == parent->left) {
+                _rbtree_rotate_right(tree, parent);
+                node = parent;
+                parent = node->parent;
+            }
+
+            parent->color = RB_BLACK;
+            grandparent->color = RB_RED;
+            _rbtree_rotate_left(tree, grandparent);
+        }
+    }
+
+    tree->root->color = RB_BLACK;
+}
+
+// Puts new_node where old_node was as far as old_node's parent is concerned
+void _rbtree_transplant(RbTree* tree, RbNode* old_node, RbNode* new_node) {
+    if (old_node->parent == NULL) {
+        tree->root = new_node;
+    } else if (old_node == old_node->parent->left) {
+        old_node->parent->left = new_node;
+    } else {
+        old_node->parent->right = new_node;
+    }
+
+    if (new_node != NULL) {
+        new_node->parent = old_node->parent;
+    }
+}
+
+void rbtree_remove(RbTree* tree, RbNode* node) {
+    RbNode* child;
+    RbNode* child_parent;
+    RbNode* successor;
+    RbNode* sibling;
+    int removed_color;
+
+    if (tree->leftmost == node) {
+        tree->leftmost = rbtree_next(node);
+    }
+
+    removed_color = node->color;
+
+    if (node->left == NULL) {
+        child = node->right;
+        child_parent = node->parent;
+        _rbtree_transplant(tree, node, child);
+    } else if (node->right == NULL) {
+        child = node->left;
+        child_parent = node->parent;
+        _rbtree_transplant(tree, node, child);
+    } else {
+        successor = node->right;
+        while (successor->left != NULL) {
+            successor = successor->left;
+        }
+
+        removed_color = successor->color;
+        child = successor->right;
+
+        if (successor->parent == node) {
+            child_parent = successor;
+        } else {
+            child_parent = successor->parent;
+            _rbtree_transplant(tree, successor, successor->right);
+            successor->right = node->right;
+            successor->right->parent = successor;
+        }
+
+        _rbtree_transplant(tree, node, successor);
+        successor->left = node->left;
+        successor->left->parent = successor;
+        successor->color = node->color;
+    }
+
+    node->parent = NULL;
+    node->left = NULL;
+    node->right = NULL;
+
+    if (removed_color != RB_BLACK) {
+        return;
+    }
+
+    // child carries an extra black. NULL children count as black.
+    while (child != tree->root && (child == NULL || child->color == RB_BLACK)) {
+        if (child == child_parent->left) {
+            sibling = child_parent->right;
+            if (sibling->color == RB_RED) {
+                sibling->color = RB_BLACK;
+                child_parent->color = RB_RED;
+                _rbtree_rotate_left(tree, child_parent);
+                sibling = child_parent->right;
+            }
+
+            if (
+                (sibling->left == NULL || sibling->left->color == RB_BLACK) &&
+                (sibling->right == NULL || sibling->right->color == RB_BLACK)
+            ) {
+                sibling->color = RB_RED;
+                child = child_parent;
+                child_parent = child->parent;
+                continue;
+            }
+
+            if (sibling->right == NULL || sibling->right->color == RB_BLACK) {
+                sibling->left->color = RB_BLACK;
+                sibling->color = RB_RED;
+                _rbtree_rotate_right(tree, sibling);
+                sibling = child_parent->right;
+            }
+
+            sibling->color = child_parent->color;
+            child_parent->color = RB_BLACK;
+            sibling->right->color = RB_BLACK;
+            _rbtree_rotate_left(tree, child_parent);
+            child = tree->root;
+        } else {
+            sibling = child_parent->left;
+            if (sibling->color == RB_RED) {
+                sibling->color = RB_BLACK;
+                child_parent->color = RB_RED;
+                _rbtree_rotate_right(tree, child_parent);
+                sibling = child_parent->left;
+            }
+
+            if (
+                (sibling->left == NULL || sibling->left->color == RB_BLACK) &&
+                (sibling->right == NULL || sibling->right->color == RB_BLACK)
+            ) {
+                sibling->color = RB_RED;
+                child = child_parent;
+                child_parent = child->parent;
+                continue;
+            }
+
+            if (sibling->left == NULL || sibling->left->color == RB_BLACK) {
+                sibling->right->color = RB_BLACK;
+                sibling->color = RB_RED;
+                _rbtree_rotate_left(tree, sibling);
+                sibling = child_parent->left;
+            }
+
+            sibling->color = child_parent->color;
+            child_parent->color = RB_BLACK;
+            sibling->left->color = RB_BLACK;
+            _rbtree_rotate_right(tree, child_parent);
+            child = tree->root;
+        }
+    }
+
+    if (child != NULL) {
+        child->color = RB_BLACK;
+    }
+}
+
+RbNode* rbtree_first(RbTree* tree) {
+    return tree->leftmost;
+}
+
+// In order successor, or NULL if node is the last one
+RbNode* rbtree_next(RbNode* node) {
+    RbNode* parent;
+
+    if (node->right != NULL) {
+        node = node->right;
+        while (node->left != NULL) {
+            node = node->left;
+        }
+
+        return node;
+    }
+
+    parent = node->parent;
+    while (parent != NULL && node == parent->right) {
+        node = parent;
+        parent = node->parent;
+    }
+
+    return parent;
+}
+
+RbNode* rbtree_last(RbTree* tree) {
+    RbNode* node;
+
+    node = tree->root;
+    if (node == NULL) {
+        return NULL;
+    }
+
+    while (node->right != NULL) {
+        node = node->right;
+    }
+
+    return node;
+}
+
+// In order predecessor, or NULL if node is the first one
+RbNode* rbtree_prev(RbNode* node) {
+    RbNode* parent;
+
+    if (node->left != NULL) {
+        node = node->left;
+        while (node->right != NULL) {
+            node = node->right;
+        }
+
+        return node;
+    }
+
+    parent = node->parent;
+    while (parent != NULL && node == parent->left) {
+        node = parent;
+        parent = node->parent;
+    }
+
+    return parent;
+}
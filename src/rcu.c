@@ -0,0 +1,168 @@
+// rcu.c
+// Epoch based deferred reclamation.
+// Readers never take a lock: they just advertise the epoch they started in.
+// The global epoch can only move forward once every active reader has seen it,
+// so anything unlinked in epoch e is unreachable by the time we hit e + 2.
+
+
+#include <rcu.h>
+#include <hartlocal.h>
+#include <kmalloc.h>
+#include <lock.h>
+#include <printf.h>
+#include <rs_int.h>
+
+
+volatile u64 rcu_global_epoch;
+Mutex rcu_advance_lock;
+
+
+void rcu_read_lock(void) {
+    HartLocal* hl;
+
+    HARTLOCAL_GET(hl);
+
+    hl->rcu_nesting++;
+    if (hl->rcu_nesting != 1) {
+        return;
+    }
+
+    // Publish epoch and active bit in one store, then make sure our
+    // protected loads can't be hoisted above it.
+    hl->rcu_state = (rcu_global_epoch << 1) | 1;
+    asm volatile("fence rw, rw" ::: "memory");
+}
+
+void rcu_read_unlock(void) {
+    HartLocal* hl;
+
+    HARTLOCAL_GET(hl);
+
+    if (hl->rcu_nesting == 0) {
+        printf("rcu_read_unlock: unbalanced unlock on hart %d\n", hl->hart);
+        return;
+    }
+
+    hl->rcu_nesting--;
+    if (hl->rcu_nesting != 0) {
+        return;
+    }
+
+    asm volatile("fence rw, w" ::: "memory");
+    hl->rcu_state = 0;
+}
+
+// Returns true if the global epoch moved forward
+bool rcu_try_advance() {
+    u64 epoch;
+    u64 state;
+    u32 i;
+
+    if (!mutex_trylock(&rcu_advance_lock)) {
+        return false;
+    }
+
+    epoch = rcu_global_epoch;
+
+    for (i = 0; i < NUM_HARTS; i++) {
+        state = *(volatile u64*) &hart_locals[i].rcu_state;
+        if ((state & 1) && (state >> 1) != epoch) {
+            mutex_unlock(&rcu_advance_lock);
+            return false;
+        }
+    }
+
+    asm volatile("fence rw, rw" ::: "memory");
+    rcu_global_epoch = epoch + 1;
+
+    mutex_unlock(&rcu_advance_lock);
+    return true;
+}
+
+void call_rcu(void (*func)(void*), void* data) {
+    HartLocal* hl;
+    RcuCallback* cb;
+
+    HARTLOCAL_GET(hl);
+
+    cb = kmalloc(sizeof(RcuCallback));
+    cb->next = NULL;
+    cb->func = func;
+    cb->data = data;
+
+    // The caller's unlink has to be visible before we sample the epoch
+    asm volatile("fence rw, rw" ::: "memory");
+    cb->epoch = rcu_global_epoch;
+
+    if (hl->rcu_callbacks_tail == NULL) {
+        hl->rcu_callbacks = cb;
+    } else {
+        hl->rcu_callbacks_tail->next = cb;
+    }
+
+    hl->rcu_callbacks_tail = cb;
+    hl->rcu_stats.callbacks_queued++;
+}
+
+void rcu_free(void* mem) {
+    call_rcu(kfree, mem);
+}
+
+// Called wherever this hart can't be inside a read side critical section:
+// context switches, idle, and the console prompt.
+void rcu_quiescent(void) {
+    HartLocal* hl;
+    RcuCallback* cb;
+    u64 epoch;
+
+    HARTLOCAL_GET(hl);
+
+    if (hl->rcu_nesting != 0) {
+        printf("rcu_quiescent: hart %d is still in a read side critical section\n", hl->hart);
+        return;
+    }
+
+    hl->rcu_stats.quiescent_states++;
+
+    if (hl->rcu_callbacks == NULL) {
+        return;
+    }
+
+    rcu_try_advance();
+
+    epoch = rcu_global_epoch;
+    while (hl->rcu_callbacks != NULL && hl->rcu_callbacks->epoch + RCU_GRACE_EPOCHS <= epoch) {
+        cb = hl->rcu_callbacks;
+
+        hl->rcu_callbacks = cb->next;
+        if (hl->rcu_callbacks == NULL) {
+            hl->rcu_callbacks_tail = NULL;
+        }
+
+        cb->func(cb->data);
+        kfree(cb);
+
+        hl->rcu_stats.callbacks_run++;
+    }
+}
+
+
+void rcu_print() {
+    HartLocal* hl;
+    u32 i;
+
+    printf("rcu_print: global epoch: %ld\n", rcu_global_epoch);
+
+    for (i = 0; i < NUM_HARTS; i++) {
+        hl = &hart_locals[i];
+
+        printf(
+            "rcu_print: hart: %d, active: %d, queued: %ld, run: %ld, quiescent states: %ld\n",
+            i,
+            (int) (hl->rcu_state & 1),
+            hl->rcu_stats.callbacks_queued,
+            hl->rcu_stats.callbacks_run,
+            hl->rcu_stats.quiescent_states
+        );
+    }
+}
@@ -0,0 +1,245 @@
+// ring.c
+// Submission and completion queues shared with a process, so it can batch
+// many operations into one trap, or none if a worker drains them for it.
+// User space fills sqes and bumps sq_tail, and the kernel consumes them in
+// order, posting one cqe each.
+
+
+#include <ring.h>
+#include <syscall.h>
+#include <page_alloc.h>
+#include <kmalloc.h>
+#include <mmu.h>
+#include <gpu.h>
+#include <csr.h>
+#include <printf.h>
+#include <schedule.h>
+#include <rs_int.h>
+
+
+VirtioGpuRectangle _ring_unpack_rect(RingSqe* sqe) {
+    return (VirtioGpuRectangle) {
+        (u32) sqe->args[1],
+        (u32) (sqe->args[1] >> 32),
+        (u32) sqe->args[2],
+        (u32) (sqe->args[2] >> 32)
+    };
+}
+
+// Scanout ids come straight from user memory, and gpu_fill and gpu_flush trust them
+bool _ring_scanout_ok(u64 scanout_id) {
+    return (
+        virtio_gpu_device != NULL &&
+        scanout_id < VIRTIO_GPU_MAX_SCANOUTS &&
+        ((VirtioGpuDeviceInfo*) virtio_gpu_device->device_info)->displays[scanout_id].enabled
+    );
+}
+
+i64 _ring_do(Ring* ring, RingSqe* sqe) {
+    VirtioGpuPixel pixel;
+    u32 packed;
+
+    switch (sqe->op) {
+        case RING_OP_NOP:
+            return 0;
+
+        case RING_OP_GPU_FILL:
+            if (!_ring_scanout_ok(sqe->args[0])) {
+                return -1;
+            }
+
+            packed = (u32) sqe->args[3];
+            pixel = (VirtioGpuPixel) {packed, packed >> 8, packed >> 16, packed >> 24};
+
+            return gpu_fill(sqe->args[0], _ring_unpack_rect(sqe), pixel) ? 0 : -1;
+
+        case RING_OP_GPU_FLUSH:
+            if (!_ring_scanout_ok(sqe->args[0])) {
+                return -1;
+            }
+
+            return gpu_flush(sqe->args[0], _ring_unpack_rect(sqe)) ? 0 : -1;
+
+        case RING_OP_GET_EVENTS:
+            return syscall_get_events((VirtioInputEvent*) sqe->args[0], sqe->args[1], ring->rcb);
+
+        case RING_OP_READ:
+            return syscall_read(ring->rcb, sqe->args[0], sqe->args[1], sqe->args[2]);
+
+        default:
+            printf("_ring_do: unknown op: %d\n", sqe->op);
+            return -1;
+    }
+}
+
+// Runs everything submitted so far. Has to be on the process's satp,
+// since ops can touch its memory. Returns how many it consumed.
+u32 _ring_drain(Ring* ring) {
+    RingShared* shared;
+    RingSqe sqe;
+    RingCqe* cqe;
+    u32 head;
+    u32 tail;
+    u32 cq_tail;
+    u32 n;
+
+    shared = ring->shared;
+
+    mutex_sbi_lock(&ring->lock);
+
+    head = shared->sq_head;
+    tail = shared->sq_tail;
+    asm volatile("fence r, r" ::: "memory");
+
+    // User space could have written anything to tail
+    if (tail - head > RING_SQ_ENTRIES) {
+        tail = head + RING_SQ_ENTRIES;
+    }
+
+    n = 0;
+    cq_tail = shared->cq_tail;
+    while (head != tail) {
+        if (cq_tail - shared->cq_head >= RING_CQ_ENTRIES) {
+            ring->stats.cq_full++;
+            break;
+        }
+
+        // Copy it out first so user space can't change it under us
+        sqe = shared->sqes[head & (RING_SQ_ENTRIES - 1)];
+        head++;
+
+        cqe = &ring->cqes[cq_tail & (RING_CQ_ENTRIES - 1)];
+        cqe->user_data = sqe.user_data;
+        cqe->result = _ring_do(ring, &sqe);
+        cq_tail++;
+        n++;
+    }
+
+    // Publish the completions before the new tails
+    asm volatile("fence rw, w" ::: "memory");
+    shared->sq_head = head;
+    shared->cq_tail = cq_tail;
+
+    ring->stats.submitted += n;
+
+    mutex_unlock(&ring->lock);
+
+    return n;
+}
+
+// Worker side of RING_ENTER_ASYNC. Kernel threads run on the kernel's satp,
+// but every process table has the kernel in it too, so borrowing the
+// process's is safe. Workers don't get preempted, so nothing sees it.
+void _ring_work(void* data) {
+    Ring* ring;
+    u64 satp;
+
+    ring = data;
+
+    CSR_READ(satp, "satp");
+    CSR_WRITE("satp", ring->satp);
+
+    _ring_drain(ring);
+
+    CSR_WRITE("satp", satp);
+
+    // Drop the reference ring_enter took for us
+    process_rcb_put(ring->rcb);
+}
+
+
+// Maps the process's rings, making them the first time. Returns where they are, or 0.
+uint64_t ring_setup(Process* process) {
+    ResourceControlBlock* rcb;
+    Ring* ring;
+    u64 user_flag;
+
+    rcb = process->rcb;
+
+    mutex_sbi_lock(&rcb->lock);
+
+    if (rcb->ring != NULL) {
+        mutex_unlock(&rcb->lock);
+        return RING_VADDR;
+    }
+
+    ring = kzalloc(sizeof(Ring));
+    if (ring == NULL) {
+        mutex_unlock(&rcb->lock);
+        printf("ring_setup: kzalloc failed\n");
+        return 0;
+    }
+
+    ring->shared = page_zalloc(RING_PAGES);
+    if (ring->shared == NULL) {
+        mutex_unlock(&rcb->lock);
+        printf("ring_setup: page_zalloc failed\n");
+        kfree(ring);
+        return 0;
+    }
+
+    ring->cqes = (RingCqe*) ((u8*) ring->shared + PS_4K);
+    ring->shared->sq_entries = RING_SQ_ENTRIES;
+    ring->shared->cq_entries = RING_CQ_ENTRIES;
+    ring->lock = MUTEX_UNLOCKED;
+    ring->satp = process->frame.satp;
+    ring->rcb = rcb;
+    work_prepare(&ring->work, _ring_work, ring);
+
+    user_flag = process->supervisor_mode ? 0 : PB_USER;
+    if (
+        !mmu_map_many(
+            rcb->ptable,
+            RING_VADDR,
+            mmu_translate(kernel_mmu_table, (u64) ring->shared),
+            PS_4K * RING_PAGES,
+            user_flag | PB_READ | PB_WRITE
+        )
+    ) {
+        mutex_unlock(&rcb->lock);
+        printf("ring_setup: mmu_map_many failed\n");
+        page_dealloc(ring->shared);
+        kfree(ring);
+        return 0;
+    }
+
+    rcb->ring = ring;
+
+    mutex_unlock(&rcb->lock);
+
+    return RING_VADDR;
+}
+
+// Returns how many submissions were consumed, 0 if they were handed to a worker,
+// or -1 if the process never set up its rings
+int64_t ring_enter(Process* process, uint32_t flags) {
+    Ring* ring;
+
+    ring = process->rcb->ring;
+    if (ring == NULL) {
+        return -1;
+    }
+
+    if (!(flags & RING_ENTER_ASYNC)) {
+        ring->stats.enters++;
+        return _ring_drain(ring);
+    }
+
+    ring->stats.async_enters++;
+
+    // The process can exit before the worker gets to it
+    process_rcb_get(ring->rcb);
+    // Always the same worker, so two harts can't queue it at once
+    if (!workqueue_queue_on(SCHEDULE_FIRST_HART + process->tgid % (NUM_HARTS - SCHEDULE_FIRST_HART), &ring->work)) {
+        // Already queued, and that drain will see these too
+        process_rcb_put(ring->rcb);
+    }
+
+    return 0;
+}
+
+// Only once nothing can be using it, from when the process is freed
+void ring_free(Ring* ring) {
+    page_dealloc(ring->shared);
+    kfree(ring);
+}
@@ -4,6 +4,20 @@
 
 #include "../../sbi/src/include/svccodes.h"
 #include <hart.h>
+#include <csr.h>
+#include <hartlocal.h>
+#include <hrtimer.h>
+#include <sbi.h>
+
+
+bool sbi_has_sstc;
+
+
+bool sbi_init(void) {
+    sbi_has_sstc = (sbi_get_features() & SBI_FEATURE_SSTC) != 0;
+
+    return true;
+}
 
 
 void sbi_putchar(char c) {
@@ -12,6 +26,13 @@ void sbi_putchar(char c) {
     asm volatile ("mv a7, %0\nmv a0, %1\necall" :: "r"(SBI_PUTCHAR), "r"(c) : "a7", "a0");
 }
 
+void sbi_putstring(const char* s, unsigned long len) {
+    // a7: SBI_PUTSTRING
+    // a0: s
+    // a1: len
+    asm volatile ("mv a7, %0\nmv a0, %1\nmv a1, %2\necall" :: "r"(SBI_PUTSTRING), "r"(s), "r"(len) : "a7", "a0", "a1", "memory");
+}
+
 char sbi_getchar(void) {
     char c;
 
@@ -62,15 +83,31 @@ int sbi_whoami(void) {
     return hart;
 }
 
+unsigned long sbi_get_features(void) {
+    unsigned long features;
+
+    asm volatile ("mv a7, %1\necall\nmv %0, a0" : "=r"(features) : "r"(SBI_GET_FEATURES) : "a7", "a0");
+
+    return features;
+}
+
+// The SBI lets us read time ourselves, so this never actually calls into it
 unsigned long sbi_get_time(void) {
     unsigned long time;
 
-    asm volatile ("mv a7, %1\necall\nmv %0, a0" : "=r"(time) : "r"(SBI_GET_TIME) : "a7", "a0");
+    asm volatile ("rdtime %0" : "=r"(time));
 
     return time;
 }
 
+// Our own timer goes straight into stimecmp if we have Sstc.
+// Other harts' timers still need the SBI.
 void sbi_set_timer(int hart, unsigned long val) {
+    if (sbi_has_sstc && hart == hartlocal_whoami()) {
+        CSR_WRITE(CSR_STIMECMP, val);
+        return;
+    }
+
     asm volatile ("mv a7, %0\nmv a0, %1\nmv a1, %2\necall" :: "r"(SBI_SET_TIMER), "r"(hart), "r"(val) : "a7", "a0", "a1");
 }
 
@@ -79,9 +116,26 @@ void sbi_add_timer(int hart, unsigned long duration) {
 }
 
 void sbi_ack_timer(void) {
+    // Sstc's STIP clears itself once stimecmp is in the future again
+    if (sbi_has_sstc) {
+        CSR_WRITE(CSR_STIMECMP, HRTIMER_TIME_INFINITE);
+        return;
+    }
+
     asm volatile ("mv a7, %0\necall" :: "r"(SBI_ACK_TIMER) : "a7");
 }
 
+bool sbi_send_ipi(int hart) {
+    bool sent;
+
+    // a7: SBI_SEND_IPI
+    // a0: hart
+    asm volatile ("mv a7, %1\nmv a0, %2\necall\nmv %0, a0" : "=r"(sent) : "r"(SBI_SEND_IPI), "r"(hart) : "a7", "a0");
+    // a0: sent
+
+    return sent;
+}
+
 void sbi_poweroff(void) {
     asm volatile ("mv a7, %0\necall" :: "r"(SBI_POWEROFF) : "a7");
 }
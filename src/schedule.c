@@ -8,59 +8,117 @@
 #include <start.h>
 #include <lock.h>
 #include <mmu.h>
+#include <page_alloc.h>
 #include <printf.h>
 #include <rs_int.h>
-
-
-Process* current_processes[NUM_HARTS];
-Process* idle_processes[NUM_HARTS];
-List* schedule_processes;
-Mutex schedule_lock;
-
+#include <hartlocal.h>
+#include <rcu.h>
+#include <hrtimer.h>
+#include <trace.h>
+
+
+RunQueue schedule_run_queues[NUM_HARTS];
+
+// Sum of every real-time process's bandwidth, for admission control
+u64 schedule_rt_bandwidth;
+Mutex schedule_rt_lock;
+
+// CFS weights, indexed by nice - PROCESS_NICE_MIN. Each nice level
+// is about 10% more or less CPU than the one next to it.
+const u32 schedule_nice_to_weight[PROCESS_NICE_MAX - PROCESS_NICE_MIN + 1] = {
+    /* -20 */   88761,  71755,  56483,  46273,  36291,
+    /* -15 */   29154,  23254,  18705,  14949,  11916,
+    /* -10 */   9548,   7620,   6100,   4904,   3906,
+    /*  -5 */   3121,   2501,   1991,   1586,   1277,
+    /*   0 */   1024,   820,    655,    526,    423,
+    /*   5 */   335,    272,    215,    172,    137,
+    /*  10 */   110,    87,     70,     56,     45,
+    /*  15 */   36,     29,     23,     18,     15,
+};
+
+
+bool _rq_less(RbNode* a, RbNode* b) {
+    return RBTREE_ENTRY(a, Process, rq_node)->stats.vruntime < RBTREE_ENTRY(b, Process, rq_node)->stats.vruntime;
+}
 
 void schedule_assert() {
-    ListNode* it;
-    ListNode* nit;
+    RunQueue* rq;
+    RbNode* it;
+    RbNode* nit;
     Process* p1;
     Process* p2;
+    u32 hart;
     u32 i;
     bool error_flag;
 
-    mutex_sbi_lock(&schedule_lock);
-
     error_flag = false;
-    i = 0;
-    for (it = schedule_processes->head; it != NULL; it = it->next) {
-        nit = it->next;
-        if (nit == NULL) {
-            break;
-        }
+    for (hart = SCHEDULE_FIRST_HART; hart < NUM_HARTS; hart++) {
+        rq = &schedule_run_queues[hart];
+
+        mutex_sbi_lock(&rq->lock);
+
+        i = 0;
+        for (it = rbtree_first(&rq->runnable); it != NULL; it = nit) {
+            nit = rbtree_next(it);
+            if (nit == NULL) {
+                break;
+            }
+
+            p1 = RBTREE_ENTRY(it, Process, rq_node);
+            p2 = RBTREE_ENTRY(nit, Process, rq_node);
+            if (p2->stats.vruntime < p1->stats.vruntime) {
+                printf("schedule_assert: error: hart %d run queue out of order\n", hart);
+                printf("%d: pid: %d -> %d: pid: %d (%d > %d)\n", i, p1->pid, i+1, p2->pid, p1->stats.vruntime, p2->stats.vruntime);
+                error_flag = true;
+            }
 
-        p1 = it->data;
-        p2 = nit->data;
-        if (p2->stats.vruntime < p1->stats.vruntime) {
-            printf("schedule_assert: error: schedule list out of order\n");
-            printf("%d: pid: %d -> %d: pid: %d (%d > %d)\n", i, p1->pid, i+1, p2->pid, p1->stats.vruntime, p2->stats.vruntime);
-            error_flag = true;
+            i++;
         }
 
-        i++;
+        mutex_unlock(&rq->lock);
     }
 
-    mutex_unlock(&schedule_lock);
-    
     if (error_flag) {
         schedule_print();
     }
 }
 
 
+// Fires when the current process's quantum is up
+void _schedule_preempt(void* data) {
+    ((HartLocal*) data)->need_resched = true;
+}
+
+
 bool schedule_init() {
     Process* idle;
+    void* trap_stack;
     u32 i;
+    u32 j;
+
+    schedule_rt_lock = MUTEX_UNLOCKED;
+    schedule_rt_bandwidth = 0;
+
+    for (i = 0; i < NUM_HARTS; i++) {
+        // Traps are never nested and the kernel never blocks on a trap stack,
+        // so one per hart is enough, and nobody else can be standing on it
+        trap_stack = page_zalloc(PROCESS_DEFAULT_TRAP_STACK_PAGES);
+        if (trap_stack == NULL) {
+            printf("schedule_init: trap stack page_zalloc failed\n");
+            return false;
+        }
+
+        hart_locals[i].trap_stack = (u64) trap_stack + PS_4K * PROCESS_DEFAULT_TRAP_STACK_PAGES;
+
+        schedule_run_queues[i].lock = MUTEX_UNLOCKED;
+        rbtree_init(&schedule_run_queues[i].runnable, _rq_less);
+        for (j = 0; j < SCHEDULE_RT_PRIORITIES; j++) {
+            schedule_run_queues[i].rt_queues[j] = list_new();
+        }
+
+        hrtimer_prepare(&hart_locals[i].preempt_timer, _schedule_preempt, &hart_locals[i]);
+    }
 
-    schedule_processes = list_new();
-    
     // Initialize NUM_HARTS new idle processes
     for (i = 0; i < NUM_HARTS; i++) {
         idle = process_new();
@@ -68,86 +126,313 @@ bool schedule_init() {
         if (!process_prepare(idle)) {
             return false;
         }
-        
+
         idle->quantum = PROCESS_IDLE_QUANTUM; // More freqent context switches
-        idle->frame.sepc = PROCESS_IDLE_ENTRY + ((u64) park & 0x0fff);
-        if (!mmu_map(idle->rcb.ptable, idle->frame.sepc, (u64) park, PB_EXECUTE)) {
-            printf("schedule_init: idle park map failed\n");
-            return false;
-        }
+        idle->frame.sepc = (u64) park;  // Kernel text is mapped everywhere
 
-        idle_processes[i] = idle;
+        hart_locals[i].idle_process = idle;
     }
 
     return true;
 }
 
-void schedule_add(Process* new_process) {
-    ListNode* it;
-    ListNode* nit;
-    Process* p;
 
-    // Don't add if NULL or idle process
-    if (new_process == NULL || new_process->pid <= NUM_HARTS) {
+// Run queue helpers. The caller must hold rq->lock.
+
+// preempted is only true when putting back a process that was running here.
+// A preempted FIFO process goes back to the front of its priority.
+void _rq_enqueue(RunQueue* rq, int hart, Process* new_process, bool preempted) {
+    List* rt_queue;
+
+    new_process->stats.enqueuetime = sbi_get_time();
+    new_process->rq_hart = hart;
+    rq->nr_queued++;
+
+    if (new_process->policy == SP_NORMAL) {
+        rbtree_insert(&rq->runnable, &new_process->rq_node);
         return;
     }
 
-    mutex_sbi_lock(&schedule_lock);
+    rt_queue = rq->rt_queues[new_process->rt.priority];
+    if (preempted && new_process->policy == SP_FIFO) {
+        list_insert(rt_queue, new_process);
+    } else {
+        list_insert_after(rt_queue, rt_queue->last, new_process);
+    }
+
+    rq->rt_bitmap |= 1U << new_process->rt.priority;
+}
 
-    // if (new_process->state == PS_DEAD) {
-    //     new_process->state = PS_RUNNING;
-    // }
+void _rq_dequeue(RunQueue* rq, Process* process) {
+    List* rt_queue;
 
-    // Just insert at beginning if empty or smallest
-    if (
-        schedule_processes->head == NULL ||
-        ((Process*) schedule_processes->head->data)->stats.vruntime >= new_process->stats.vruntime
-    ) {
-        list_insert(schedule_processes, new_process);
-        mutex_unlock(&schedule_lock);
+    if (process->policy == SP_NORMAL) {
+        rbtree_remove(&rq->runnable, &process->rq_node);
+    } else {
+        rt_queue = rq->rt_queues[process->rt.priority];
+        list_remove(rt_queue, process);
+        if (rt_queue->head == NULL) {
+            rq->rt_bitmap &= ~(1U << process->rt.priority);
+        }
+    }
+
+    process->rq_hart = -1;
+    rq->nr_queued--;
+}
+
+// Removes and returns the highest priority real-time process, if any
+Process* _rq_pick_rt(RunQueue* rq) {
+    Process* process;
+    int priority;
+
+    if (rq->rt_bitmap == 0) {
+        return NULL;
+    }
+
+    for (priority = SCHEDULE_RT_PRIORITIES - 1; !(rq->rt_bitmap & (1U << priority)); priority--);
+
+    process = rq->rt_queues[priority]->head->data;
+    _rq_dequeue(rq, process);
+
+    return process;
+}
+
+// Removes and returns the next process to run. Real-time processes
+// always go first, then the one with the smallest vruntime.
+Process* _rq_pick(RunQueue* rq) {
+    RbNode* node;
+    Process* process;
+
+    process = _rq_pick_rt(rq);
+    if (process != NULL) {
+        return process;
+    }
+
+    node = rbtree_first(&rq->runnable);
+    if (node == NULL) {
+        return NULL;
+    }
+
+    process = RBTREE_ENTRY(node, Process, rq_node);
+    _rq_dequeue(rq, process);
+
+    if (process->stats.vruntime > rq->min_vruntime) {
+        rq->min_vruntime = process->stats.vruntime;
+    }
+
+    return process;
+}
+
+// Same as _rq_pick, but takes the largest vruntime that's allowed on hart,
+// so we take the process that would have waited the longest on its own hart
+Process* _rq_pick_last(RunQueue* rq, int hart) {
+    RbNode* node;
+    Process* process;
+
+    for (node = rbtree_last(&rq->runnable); node != NULL; node = rbtree_prev(node)) {
+        process = RBTREE_ENTRY(node, Process, rq_node);
+        if (SCHEDULE_CAN_RUN_ON(process, hart)) {
+            _rq_dequeue(rq, process);
+            return process;
+        }
+    }
+
+    return NULL;
+}
+
+// vruntimes only mean something relative to their own queue's min_vruntime
+void _rq_migrate_vruntime(Process* process, RunQueue* from, RunQueue* to) {
+    u64 lag;
+
+    if (process->stats.vruntime >= from->min_vruntime) {
+        process->stats.vruntime = process->stats.vruntime - from->min_vruntime + to->min_vruntime;
         return;
     }
 
-    // Find last node with smaller vruntime
-    for (it = schedule_processes->head; it != NULL; it = it->next) {
-        nit = it->next;
-        if (nit == NULL) {
-            break;
+    // Woken sleepers can sit a little below min_vruntime
+    lag = from->min_vruntime - process->stats.vruntime;
+    process->stats.vruntime = lag < to->min_vruntime ? to->min_vruntime - lag : 0;
+}
+
+// Racy on purpose: only used as a hint, the caller locks and rechecks
+int _schedule_busiest_hart(int except) {
+    int busiest;
+    u32 max_queued;
+    u32 nr_queued;
+    int i;
+
+    busiest = -1;
+    max_queued = 0;
+    for (i = SCHEDULE_FIRST_HART; i < NUM_HARTS; i++) {
+        if (i == except) {
+            continue;
         }
-        
-        p = nit->data;
-        if (p->stats.vruntime >= new_process->stats.vruntime) {
-            break;
+
+        nr_queued = *(volatile u32*) &schedule_run_queues[i].nr_queued;
+        if (nr_queued > max_queued) {
+            max_queued = nr_queued;
+            busiest = i;
         }
     }
 
-    list_insert_after(schedule_processes, it, new_process);
-    mutex_unlock(&schedule_lock);
+    return busiest;
 }
 
-// Internal schedule_remove
-bool _schedule_remove(Process* process, bool lock) {
-    bool rv;
+u32 _schedule_load(int hart) {
+    u32 load;
+    Process* current;
 
-    if (process == NULL || process->pid <= NUM_HARTS) {
+    load = *(volatile u32*) &schedule_run_queues[hart].nr_queued;
+
+    current = *(Process* volatile*) &hart_locals[hart].current_process;
+    if (current != NULL && current != hart_locals[hart].idle_process) {
+        load++;
+    }
+
+    return load;
+}
+
+// Picks where process should be queued. Prefers the hart it last ran on,
+// where its cache and TLB entries may still be warm, unless another allowed
+// hart is clearly less loaded.
+int _schedule_select_hart(Process* process) {
+    int idlest;
+    u32 min_load;
+    u32 load;
+    int i;
+
+    idlest = -1;
+    min_load = -1U;
+    for (i = SCHEDULE_FIRST_HART; i < NUM_HARTS; i++) {
+        if (!SCHEDULE_CAN_RUN_ON(process, i)) {
+            continue;
+        }
+
+        load = _schedule_load(i);
+        if (load < min_load) {
+            min_load = load;
+            idlest = i;
+        }
+    }
+
+    if (
+        process->last_hart != -1 &&
+        SCHEDULE_CAN_RUN_ON(process, process->last_hart) &&
+        _schedule_load(process->last_hart) <= min_load + SCHEDULE_CACHE_HOT_SLACK
+    ) {
+        return process->last_hart;
+    }
+
+    return idlest;
+}
+
+
+// True if new_process should kick current off its hart right away
+bool _schedule_should_preempt(Process* current, Process* new_process) {
+    if (new_process->policy == SP_NORMAL) {
         return false;
     }
 
-    if (lock) {
-        mutex_sbi_lock(&schedule_lock);
+    return current->policy == SP_NORMAL || new_process->rt.priority > current->rt.priority;
+}
+
+// Get hart to look at its run queue if it's idle, or if new_process should
+// preempt what it's running. Idle harts sit in wfi with no timer armed,
+// so without this they'd never notice new work.
+void _schedule_kick(int hart, Process* new_process) {
+    HartLocal* hl;
+    Process* current;
+
+    current = *(Process* volatile*) &hart_locals[hart].current_process;
+
+    // NULL means it's somewhere in schedule_schedule and may be about to pick idle
+    if (
+        current != NULL &&
+        current != hart_locals[hart].idle_process &&
+        !_schedule_should_preempt(current, new_process)
+    ) {
+        return;
     }
 
-    rv = list_remove(schedule_processes, process);
+    HARTLOCAL_GET(hl);
+    if (hl->hart == (u64) hart) {
+        hl->need_resched = true;
+        return;
+    }
+
+    sbi_send_ipi(hart);
+}
+
+void _schedule_add(Process* new_process, bool waking) {
+    RunQueue* rq;
+    u64 floor;
+    int hart;
+
+    // Don't add if NULL, dead, or idle process
+    if (new_process == NULL || new_process->pid <= NUM_HARTS || new_process->state == PS_DEAD) {
+        return;
+    }
 
-    if (lock) {
-        mutex_unlock(&schedule_lock);
+    hart = _schedule_select_hart(new_process);
+    if (hart == -1) {
+        printf("_schedule_add: pid %d has no hart it can run on\n", new_process->pid);
+        return;
     }
 
-    return rv;
+    rq = &schedule_run_queues[hart];
+
+    mutex_sbi_lock(&rq->lock);
+
+    // A brand new process starts behind everyone so it can't starve them,
+    // and a sleeper only gets a small head start for however long it slept
+    floor = 0;
+    if (new_process->stats.switches == 0) {
+        floor = rq->min_vruntime + SCHEDULE_NEW_DEBIT;
+    } else if (waking && rq->min_vruntime > SCHEDULE_WAKEUP_BONUS) {
+        floor = rq->min_vruntime - SCHEDULE_WAKEUP_BONUS;
+    }
+
+    if (new_process->stats.vruntime < floor) {
+        new_process->stats.vruntime = floor;
+    }
+
+    _rq_enqueue(rq, hart, new_process, false);
+    mutex_unlock(&rq->lock);
+
+    _schedule_kick(hart, new_process);
+}
+
+void schedule_add(Process* new_process) {
+    _schedule_add(new_process, false);
 }
 
 bool schedule_remove(Process* process) {
-    return _schedule_remove(process, true); // Always lock, externally
+    RunQueue* rq;
+    int hart;
+
+    if (process == NULL || process->pid <= NUM_HARTS) {
+        return false;
+    }
+
+    // The process can be stolen between reading rq_hart and locking, so recheck
+    while (true) {
+        hart = *(volatile int*) &process->rq_hart;
+        if (hart == -1) {
+            return false;
+        }
+
+        rq = &schedule_run_queues[hart];
+
+        mutex_sbi_lock(&rq->lock);
+
+        if (process->rq_hart == hart) {
+            _rq_dequeue(rq, process);
+            mutex_unlock(&rq->lock);
+            return true;
+        }
+
+        mutex_unlock(&rq->lock);
+    }
 }
 
 Process* schedule_get_process_on_hart(int hart) {
@@ -155,7 +440,7 @@ Process* schedule_get_process_on_hart(int hart) {
         return NULL;
     }
 
-    return current_processes[hart];
+    return hart_locals[hart].current_process;
 }
 
 bool schedule_stop(Process* process) {
@@ -168,137 +453,561 @@ bool schedule_stop(Process* process) {
     return rv;
 }
 
-Process* schedule_pop() {
-    ListNode* it;
+// Take one runnable process from the busiest other hart
+Process* _schedule_steal(int hart) {
+    RunQueue* rq;
+    Process* process;
+    int victim;
+
+    victim = _schedule_busiest_hart(hart);
+    if (victim == -1) {
+        return NULL;
+    }
+
+    rq = &schedule_run_queues[victim];
+
+    mutex_sbi_lock(&rq->lock);
+    process = _rq_pick_last(rq, hart);
+    mutex_unlock(&rq->lock);
+
+    if (process != NULL) {
+        _rq_migrate_vruntime(process, rq, &schedule_run_queues[hart]);
+        schedule_run_queues[hart].stats.steals++;
+    }
+
+    return process;
+}
+
+Process* schedule_pop(int hart) {
+    RunQueue* rq;
     Process* process;
-    u64 current_time;
 
     // Make sure we're doing what we should be doing
     // schedule_assert();  // todo: remove after debugging
 
-    mutex_sbi_lock(&schedule_lock);
+    rq = &schedule_run_queues[hart];
+    mutex_sbi_lock(&rq->lock);
+    process = _rq_pick(rq);
+    mutex_unlock(&rq->lock);
 
-    current_time = sbi_get_time();
+    if (process == NULL) {
+        process = _schedule_steal(hart);
+    }
 
-    // Find the first process available for running
-    process = NULL;
-    for (it = schedule_processes->head; it != NULL; it = it->next) {
-        process = it->data;
-        if (
-            process->on_hart == -1 && (
-                process->state == PS_RUNNING || (
-                    process->state == PS_SLEEPING &&
-                    process->sleep_until <= current_time
-                )
-            )
-        ) {
-            break;
+    return process;
+}
+
+// Pull one process over if the busiest hart has at least two more queued than we do
+void _schedule_balance(int hart) {
+    RunQueue* rq;
+    RunQueue* busiest_rq;
+    RunQueue* first;
+    RunQueue* second;
+    Process* process;
+    int busiest;
+
+    busiest = _schedule_busiest_hart(hart);
+    if (busiest == -1) {
+        return;
+    }
+
+    rq = &schedule_run_queues[hart];
+    busiest_rq = &schedule_run_queues[busiest];
+
+    // Always lock in hart order so two balancing harts can't deadlock
+    if (hart < busiest) {
+        first = rq;
+        second = busiest_rq;
+    } else {
+        first = busiest_rq;
+        second = rq;
+    }
+
+    mutex_sbi_lock(&first->lock);
+    mutex_sbi_lock(&second->lock);
+
+    if (busiest_rq->nr_queued >= rq->nr_queued + 2) {
+        process = _rq_pick_last(busiest_rq, hart);
+        if (process != NULL) {
+            _rq_migrate_vruntime(process, busiest_rq, rq);
+            _rq_enqueue(rq, hart, process, false);
+            rq->stats.balance_pulls++;
         }
+    }
 
-        process = NULL;
+    mutex_unlock(&second->lock);
+    mutex_unlock(&first->lock);
+}
+
+// Switch without leaving S-mode. We're in a trap on this hart, and the end of
+// process_trap_vector restores whichever frame sscratch points to, so all
+// that's left is the CSRs the trap vector doesn't handle.
+void _schedule_switch(Process* process) {
+    HartLocal* hl;
+    u64 sstatus;
+
+    HARTLOCAL_GET(hl);
+
+    // Someone's ASID was released since we last flushed, and whoever
+    // gets it next mustn't see the old owner's translations
+    if (hl->asid_generation != process_asid_generation) {
+        hl->asid_generation = process_asid_generation;
+        SFENCE();
     }
 
-    // Remove process without locking (we already have the lock)
-    _schedule_remove(process, false);
+    // FS stays off until c_trap is on its way out, see _c_trap_fp_return
+    sstatus = (process->frame.sstatus & ~SSTATUS_FS_DIRTY) | SSTATUS_FS_OFF;
 
-    mutex_unlock(&schedule_lock);
-    return process;
+    CSR_WRITE("sscratch", (u64) &process->frame);
+    CSR_WRITE("sepc", process->frame.sepc);
+    CSR_WRITE("sstatus", sstatus);
+    CSR_WRITE("sie", process->frame.sie);
+}
+
+// How long process gets before the preemption timer goes off
+u64 _schedule_slice(Process* process) {
+    u64 quantum;
+    u64 budget;
+
+    quantum = process->quantum * SCHEDULE_CTX_TIME;
+    if (process->policy == SP_NORMAL) {
+        return quantum;
+    }
+
+    // New period, new budget
+    if (process->stats.starttime >= process->rt.period_start + process->rt.period) {
+        process->rt.period_start = process->stats.starttime;
+        process->rt.used = 0;
+    }
+
+    // Went over while it wasn't queued. The next park throttles it.
+    if (process->rt.used >= process->rt.runtime) {
+        return 0;
+    }
+
+    budget = process->rt.runtime - process->rt.used;
+    if (process->policy == SP_FIFO || budget < quantum) {
+        return budget;
+    }
+
+    return quantum;
+}
+
+void _schedule_rt_replenish(void* data) {
+    Process* process;
+
+    process = data;
+    process->rt.throttled = false;
+    process->rt.used = 0;
+    process->rt.period_start = sbi_get_time();
+
+    schedule_add(process);
+}
+
+// Throttles process until its next period if it's used up its budget.
+// Only for processes about to be queued, since the replenish timer queues them.
+// The caller must hold rq->lock.
+bool _schedule_rt_throttle(RunQueue* rq, int hart, Process* process) {
+    if (process->rt.used < process->rt.runtime) {
+        return false;
+    }
+
+    process->rt.throttled = true;
+    rq->stats.rt_throttles++;
+
+    hrtimer_prepare(&process->rt_timer, _schedule_rt_replenish, process);
+    hrtimer_start(&process->rt_timer, hart, process->rt.period_start + process->rt.period, 0);
+
+    return true;
 }
 
 bool schedule_run(int hart, Process* process) {
-    current_processes[hart] = process;
+    hart_locals[hart].current_process = process;
+    hart_locals[hart].stats.switches++;
     process->on_hart = hart;
     process->state = PS_RUNNING;
+    process->stats.switches++;
+    if (process->last_hart != -1 && process->last_hart != hart) {
+        process->stats.migrations++;
+        trace_event(TE_MIGRATE, hart, process->pid, process->last_hart);
+    }
 
-    schedule_add(process);
+    process->last_hart = hart;
+    process->frame.kernel_tp = (u64) &hart_locals[hart];
+    process->frame.trap_stack = hart_locals[hart].trap_stack;
+    if (process->kernel_thread) {
+        process->frame.gpregs[XREG_TP] = process->frame.kernel_tp;
+    }
 
     process->stats.starttime = sbi_get_time();
-    sbi_add_timer(hart, process->quantum * SCHEDULE_CTX_TIME);
+    hart_locals[hart].need_resched = false;
 
+    if (process != hart_locals[hart].idle_process) {
+        trace_wait(process->stats.starttime - process->stats.enqueuetime);
+    }
+
+    if (process->stats.waketime != 0) {
+        trace_wakeup_latency(process->stats.starttime - process->stats.waketime);
+        process->stats.waketime = 0;
+    }
+
+    // Tickless idle: nothing to preempt, so just wfi until an IPI or some other hrtimer
+    if (process == hart_locals[hart].idle_process) {
+        hart_locals[hart].idle_stats.entries++;
+        hart_locals[hart].idle_since = process->stats.starttime;
+        hrtimer_cancel(&hart_locals[hart].preempt_timer);
+    } else {
+        hrtimer_start(
+            &hart_locals[hart].preempt_timer,
+            hart,
+            process->stats.starttime + _schedule_slice(process),
+            0
+        );
+    }
+
+    if (hart == hartlocal_whoami()) {
+        _schedule_switch(process);
+        return true;
+    }
+
+    // Only for starting a hart from somewhere else, like main does on boot.
+    // process_spawn loads FP state eagerly and flushes the whole TLB.
+    hart_locals[hart].stats.cold_starts++;
+    hart_locals[hart].asid_generation = process_asid_generation;
+    hart_locals[hart].fp_owner = process;
+    process->fp_hart = hart;
     return sbi_hart_start(hart, process_spawn_addr, mmu_translate(kernel_mmu_table, (u64) &process->frame));
 }
 
-void schedule_park(int hart) {
+// Internal schedule_park. The caller must hold the hart's run queue lock.
+// Returns the process if it still needs queueing somewhere other than here.
+Process* _schedule_park(int hart) {
     Process* process;
+    RbNode* last;
     u64 current_time;
+    bool yielding;
+    bool queued;
+
+    yielding = hart_locals[hart].yielding;
+    hart_locals[hart].yielding = false;
 
-    process = current_processes[hart];
+    process = hart_locals[hart].current_process;
     if (process == NULL) {
-        return;
+        return NULL;
     }
 
     current_time = sbi_get_time();
 
-    // Remove process, update properties, add process
-    schedule_remove(process);
+    // Sleeping and waiting count against the budget too, for whatever they ran before it
+    if (process->policy != SP_NORMAL) {
+        process->rt.used += current_time - process->stats.starttime;
+    }
+
+    // It was woken between marking itself waiting and getting here, and the waker already queued it.
+    // Its vruntime is a run queue key now, so it keeps whatever the waker gave it.
+    queued = process->rq_hart != -1;
 
-    process->stats.vruntime += current_time - process->stats.starttime;
-    current_processes[hart] = NULL;
-    process->on_hart = -1;
+    // Heavier processes accrue vruntime slower, so they get picked more often
+    if (process->policy == SP_NORMAL && !queued) {
+        process->stats.vruntime += (current_time - process->stats.starttime) * PROCESS_NICE_0_WEIGHT / process->weight;
+    }
 
-    schedule_add(process);
+    if (process == hart_locals[hart].idle_process) {
+        hart_locals[hart].idle_stats.ticks += current_time - hart_locals[hart].idle_since;
+    }
+
+    hart_locals[hart].current_process = NULL;
+    process->on_hart = -1;
 
     // Store sepc so we can jump back to where we left off
     CSR_READ(process->frame.sepc, "sepc");
+
+    if (process->state == PS_DEAD) {
+        schedule_set_scheduler(process, SP_NORMAL, 0, 0, 0);
+    }
+
+    // Running processes aren't queued anywhere, so put it back on our own queue.
+    // Sleepers stay off every queue until their timer wakes them.
+    if (process == hart_locals[hart].idle_process || process->state != PS_RUNNING) {
+        return NULL;
+    }
+
+    if (queued) {
+        return NULL;
+    }
+
+    // Throttled ones wait for their replenish timer
+    if (process->policy != SP_NORMAL && _schedule_rt_throttle(&schedule_run_queues[hart], hart, process)) {
+        return NULL;
+    }
+
+    // Its affinity changed while it was running
+    if (!SCHEDULE_CAN_RUN_ON(process, hart)) {
+        return process;
+    }
+
+    // Yielding goes behind everything else queued here. Equal vruntimes keep insertion order.
+    if (yielding) {
+        last = rbtree_last(&schedule_run_queues[hart].runnable);
+        if (
+            process->policy == SP_NORMAL &&
+            last != NULL &&
+            RBTREE_ENTRY(last, Process, rq_node)->stats.vruntime > process->stats.vruntime
+        ) {
+            process->stats.vruntime = RBTREE_ENTRY(last, Process, rq_node)->stats.vruntime;
+        }
+    }
+
+    _rq_enqueue(&schedule_run_queues[hart], hart, process, !yielding);
+
+    return NULL;
+}
+
+void schedule_park(int hart) {
+    RunQueue* rq;
+    Process* process;
+
+    rq = &schedule_run_queues[hart];
+
+    mutex_sbi_lock(&rq->lock);
+    process = _schedule_park(hart);
+    mutex_unlock(&rq->lock);
+
+    schedule_add(process);
+}
+
+void _schedule_sleep_expired(void* data) {
+    schedule_wake(data);
+}
+
+// Puts the current process on hart to sleep for duration ticks and switches away
+void schedule_sleep(int hart, Process* process, uint64_t duration) {
+    process->state = PS_SLEEPING;
+    process->sleep_until = sbi_get_time() + duration;
+    trace_event(TE_SLEEP, hart, process->pid, 0);
+
+    hrtimer_prepare(&process->sleep_timer, _schedule_sleep_expired, process);
+    hrtimer_start(&process->sleep_timer, hart, process->sleep_until, HRTIMER_SLEEP_SLACK);
+
+    schedule_schedule(hart);
+}
+
+// Lets everything else queued on hart run before the current process runs again
+void schedule_yield(int hart) {
+    hart_locals[hart].yielding = true;
+    schedule_schedule(hart);
+}
+
+// Makes a sleeping or waiting process runnable again.
+// Callers waking a waiting process have to serialize with whatever it's waiting on.
+bool schedule_wake(Process* process) {
+    if (process->state != PS_SLEEPING && process->state != PS_WAITING) {
+        return false;
+    }
+
+    process->state = PS_RUNNING;
+    process->stats.waketime = sbi_get_time();
+    trace_event(TE_WAKEUP, process->last_hart, process->pid, 0);
+
+    _schedule_add(process, true);
+
+    return true;
+}
+
+bool schedule_set_nice(Process* process, int nice) {
+    if (nice < PROCESS_NICE_MIN || nice > PROCESS_NICE_MAX) {
+        return false;
+    }
+
+    // Only takes effect the next time vruntime is accrued, so no need to requeue
+    process->nice = nice;
+    process->weight = schedule_nice_to_weight[nice - PROCESS_NICE_MIN];
+
+    return true;
+}
+
+bool schedule_set_affinity(Process* process, uint64_t affinity) {
+    HartLocal* hl;
+
+    if ((affinity & SCHEDULE_AFFINITY_MASK) == 0) {
+        return false;
+    }
+
+    process->affinity = affinity & SCHEDULE_AFFINITY_MASK;
+
+    // Get off this hart at the end of the trap if we're not allowed here anymore
+    HARTLOCAL_GET(hl);
+    if (hl->current_process == process && !SCHEDULE_CAN_RUN_ON(process, hl->hart)) {
+        hl->need_resched = true;
+    }
+
+    return true;
+}
+
+// Switches process to policy. Real-time policies go through admission control:
+// the budget has to fit under SCHEDULE_RT_BW_CAP, both on its own and added
+// to every other real-time process's. runtime and period of 0 mean the defaults.
+bool schedule_set_scheduler(Process* process, int policy, int priority, uint64_t runtime, uint64_t period) {
+    u64 bandwidth;
+    u64 capacity;
+
+    if (policy != SP_NORMAL && policy != SP_FIFO && policy != SP_RR) {
+        return false;
+    }
+
+    bandwidth = 0;
+    if (policy != SP_NORMAL) {
+        if (priority < 0 || priority >= SCHEDULE_RT_PRIORITIES) {
+            return false;
+        }
+
+        if (runtime == 0 && period == 0) {
+            runtime = SCHEDULE_RT_DEFAULT_RUNTIME;
+            period = SCHEDULE_RT_DEFAULT_PERIOD;
+        }
+
+        if (runtime == 0 || period == 0 || runtime > period) {
+            return false;
+        }
+
+        bandwidth = runtime * SCHEDULE_RT_BW_SCALE / period;
+        if (bandwidth > SCHEDULE_RT_BW_CAP) {
+            return false;
+        }
+    }
+
+    capacity = (u64) SCHEDULE_RT_BW_CAP * (NUM_HARTS - SCHEDULE_FIRST_HART);
+
+    mutex_sbi_lock(&schedule_rt_lock);
+
+    if (schedule_rt_bandwidth - process->rt.bandwidth + bandwidth > capacity) {
+        mutex_unlock(&schedule_rt_lock);
+        return false;
+    }
+
+    schedule_rt_bandwidth = schedule_rt_bandwidth - process->rt.bandwidth + bandwidth;
+
+    mutex_unlock(&schedule_rt_lock);
+
+    // Only ever called on a running process, so it isn't in any queue
+    process->policy = policy;
+    process->rt.priority = policy == SP_NORMAL ? 0 : priority;
+    process->rt.bandwidth = bandwidth;
+    process->rt.runtime = runtime;
+    process->rt.period = period;
+    process->rt.used = 0;
+    process->rt.period_start = sbi_get_time();
+    process->rt.throttled = false;
+
+    return true;
 }
 
 void schedule_schedule(int hart) {
+    RunQueue* rq;
     Process* process;
+    Process* moving;
+    u16 prev_pid;
 
     if (!IS_VALID_HART(hart)) {
         printf("schedule_schedule: invalid hart: %d\n", hart);
         return;
     }
 
-    schedule_park(hart);
+    rq = &schedule_run_queues[hart];
+
+    prev_pid = hart_locals[hart].current_process == NULL ? 0 : hart_locals[hart].current_process->pid;
+
+    // Park and pick under a single acquisition of our own queue's lock
+    mutex_sbi_lock(&rq->lock);
+    moving = _schedule_park(hart);
+    process = _rq_pick(rq);
+    rq->stats.switches++;
+    mutex_unlock(&rq->lock);
+
+    schedule_add(moving);
+
+    // A context switch can never happen inside a read side critical section
+    rcu_quiescent();
+
+    if (rq->stats.switches % SCHEDULE_BALANCE_PERIOD == 0) {
+        _schedule_balance(hart);
+    }
 
     // ABC: Always Be Cscheduling
     while (true) {
-        process = schedule_pop();
         if (process == NULL) {
-            process = idle_processes[hart];
+            process = _schedule_steal(hart);
+        }
+
+        if (process == NULL) {
+            process = hart_locals[hart].idle_process;
         }
 
         if (schedule_run(hart, process)) {
+            trace_event(TE_SWITCH, hart, process->pid, prev_pid);
             return;
         }
 
         // We should only get here if the process doesn't start
 
         printf("schedule_schedule: schedule_run failed\n");
+
+        process = schedule_pop(hart);
     }
 }
 
 
 void schedule_print() {
+    RunQueue* rq;
+    u32 hart;
     u32 i;
+    int priority;
+    RbNode* node;
     ListNode* it;
     Process* process;
 
-    mutex_sbi_lock(&schedule_lock);
+    printf("schedule_print: real-time bandwidth: %ld / %ld\n", schedule_rt_bandwidth, (u64) SCHEDULE_RT_BW_CAP * (NUM_HARTS - SCHEDULE_FIRST_HART));
 
     printf("schedule_print: currently running processes:\n");
     for (i = 0; i < NUM_HARTS; i++) {
-        if (current_processes[i] != NULL) {
-            printf("schedule_print: hart: %d, pid: %2d\n", i, current_processes[i]->pid);
+        if (hart_locals[i].current_process != NULL) {
+            printf("schedule_print: hart: %d, pid: %2d\n", i, hart_locals[i].current_process->pid);
         }
     }
 
-    printf("\nschedule_print: all processes:\n");
-    i = 0;
-    for (it = schedule_processes->head; it != NULL; it = it->next) {
-        process = it->data;
-        if (process == NULL) {
-            printf("schedule_print: idx: %2d: NULL process\n");
+    for (hart = SCHEDULE_FIRST_HART; hart < NUM_HARTS; hart++) {
+        rq = &schedule_run_queues[hart];
+
+        mutex_sbi_lock(&rq->lock);
+
+        printf(
+            "\nschedule_print: hart %d run queue: queued: %d, min vruntime: %ld, switches: %ld, steals: %ld, balance pulls: %ld, rt throttles: %ld\n",
+            hart,
+            rq->nr_queued,
+            rq->min_vruntime,
+            rq->stats.switches,
+            rq->stats.steals,
+            rq->stats.balance_pulls,
+            rq->stats.rt_throttles
+        );
+
+        i = 0;
+        for (priority = SCHEDULE_RT_PRIORITIES - 1; priority >= 0; priority--) {
+            for (it = rq->rt_queues[priority]->head; it != NULL; it = it->next) {
+                process = it->data;
+                printf("schedule_print: idx: %2d, pid: %2d, policy: %d, priority: %2d, used: %ld / %ld\n", i, process->pid, process->policy, priority, process->rt.used, process->rt.runtime);
+
+                i++;
+            }
+        }
+
+        for (node = rbtree_first(&rq->runnable); node != NULL; node = rbtree_next(node)) {
+            process = RBTREE_ENTRY(node, Process, rq_node);
+            printf("schedule_print: idx: %2d, pid: %2d, tgid: %2d, vruntime: %10d, nice: %3d, state: %d, affinity: 0x%02lx, migrations: %ld\n", i, process->pid, process->tgid, process->stats.vruntime, process->nice, process->state, process->affinity, process->stats.migrations);
 
             i++;
-            continue;
         }
-        
-        printf("schedule_print: idx: %2d, pid: %2d, vruntime: %10d, state: %d, on_hart: %d\n", i, process->pid, process->stats.vruntime, process->state, process->on_hart);
 
-        i++;
+        mutex_unlock(&rq->lock);
     }
-
-    mutex_unlock(&schedule_lock);
 }
@@ -0,0 +1,207 @@
+// strace.c
+// Per-syscall counters and a log of every syscall made by traced processes.
+// Like trace.c, each hart only ever writes to its own buffer.
+
+
+#include <strace.h>
+#include <trace.h>
+#include <bitset.h>
+#include <printf.h>
+#include <rs_int.h>
+
+
+StraceBuffer strace_buffers[NUM_HARTS];
+
+// tgids being traced. Only the console changes it.
+Bitset* strace_tgids;
+
+char* strace_syscall_names[SYS_COUNT + 1] = {
+    [SYS_EXIT] = "exit",
+    [SYS_PUTCHAR] = "putchar",
+    [SYS_GETCHAR] = "getchar",
+    [SYS_YIELD] = "yield",
+    [SYS_SLEEP] = "sleep",
+    [SYS_OLD_GET_EVENTS] = "old_get_events",
+    [SYS_OLD_GET_FB] = "old_get_fb",
+    [SYS_OPEN] = "open",
+    [SYS_CLOSE] = "close",
+    [SYS_READ] = "read",
+    [SYS_WRITE] = "write",
+    [SYS_STAT] = "stat",
+    [SYS_SEEK] = "seek",
+    [SYS_GPU_GET_DISPLAY_INFO] = "gpu_get_display_info",
+    [SYS_GPU_FILL] = "gpu_fill",
+    [SYS_GPU_FLUSH] = "gpu_flush",
+    [SYS_SET_PRIORITY] = "set_priority",
+    [SYS_SET_AFFINITY] = "set_affinity",
+    [SYS_SET_SCHEDULER] = "set_scheduler",
+    [SYS_FUTEX_WAIT] = "futex_wait",
+    [SYS_FUTEX_WAKE] = "futex_wake",
+    [SYS_CLONE] = "clone",
+    [SYS_RING_SETUP] = "ring_setup",
+    [SYS_RING_ENTER] = "ring_enter",
+    [STRACE_UNKNOWN] = "unknown"
+};
+
+
+bool strace_init() {
+    strace_tgids = bitset_new(UINT16_MAX+1);
+    if (strace_tgids == NULL) {
+        printf("strace_init: bitset_new failed\n");
+        return false;
+    }
+
+    return true;
+}
+
+bool strace_enabled(uint16_t tgid) {
+    return bitset_find(strace_tgids, tgid);
+}
+
+// Returns whether tgid is traced now
+bool strace_toggle(uint16_t tgid) {
+    if (bitset_find(strace_tgids, tgid)) {
+        bitset_remove(strace_tgids, tgid);
+        return false;
+    }
+
+    bitset_insert(strace_tgids, tgid);
+    return true;
+}
+
+char* _strace_syscall_name(u64 nr) {
+    if (nr >= SYS_COUNT || strace_syscall_names[nr] == NULL) {
+        return strace_syscall_names[STRACE_UNKNOWN];
+    }
+
+    return strace_syscall_names[nr];
+}
+
+// Called on the way out of syscall_handle
+void strace_syscall(int hart, uint16_t pid, bool traced, uint64_t nr, uint64_t args[4], uint64_t rv, uint64_t start, uint64_t end) {
+    StraceBuffer* buffer;
+    StraceEntry* entry;
+    SyscallStat* stat;
+    u64 ticks;
+    u64 head;
+
+    buffer = &strace_buffers[hart];
+    ticks = end - start;
+
+    stat = &buffer->stats[nr < SYS_COUNT ? nr : STRACE_UNKNOWN];
+    stat->count++;
+    stat->total += ticks;
+    if (ticks > stat->max) {
+        stat->max = ticks;
+    }
+
+    if (!traced) {
+        return;
+    }
+
+    head = buffer->head;
+
+    entry = &buffer->ring[head & (STRACE_RING_SIZE - 1)];
+    entry->time = start;
+    entry->ticks = ticks;
+    entry->args[0] = args[0];
+    entry->args[1] = args[1];
+    entry->args[2] = args[2];
+    entry->args[3] = args[3];
+    entry->rv = rv;
+    entry->nr = nr;
+    entry->pid = pid;
+    entry->hart = hart;
+
+    // Publish the entry before the new head
+    asm volatile("fence w, w" ::: "memory");
+    buffer->head = head + 1;
+}
+
+
+void strace_print() {
+    StraceBuffer* buffer;
+    StraceEntry entry;
+    u64 head;
+    u64 start;
+    u64 i;
+    u32 hart;
+
+    for (hart = 0; hart < NUM_HARTS; hart++) {
+        buffer = &strace_buffers[hart];
+
+        head = buffer->head;
+        asm volatile("fence r, r" ::: "memory");
+
+        if (head == 0) {
+            continue;
+        }
+
+        start = head > STRACE_RING_SIZE ? head - STRACE_RING_SIZE : 0;
+
+        printf("strace_print: recorded on hart %d: %ld syscalls\n", hart, head);
+
+        for (i = start; i < head; i++) {
+            entry = buffer->ring[i & (STRACE_RING_SIZE - 1)];
+
+            // The writer lapped us while we were reading this one
+            if (trace_ring_lapped(&buffer->head, i, STRACE_RING_SIZE)) {
+                continue;
+            }
+
+            printf(
+                "strace_print: %ld: pid %d: %s(0x%lx, 0x%lx, 0x%lx, 0x%lx) = %ld (0x%lx), %ld ticks\n",
+                entry.time,
+                entry.pid,
+                _strace_syscall_name(entry.nr),
+                entry.args[0],
+                entry.args[1],
+                entry.args[2],
+                entry.args[3],
+                entry.rv,
+                entry.rv,
+                entry.ticks
+            );
+        }
+    }
+}
+
+// Sums every hart's counters. They're read without stopping the writers,
+// so a call that's being counted right now may only be half in the totals.
+void strace_print_stats() {
+    SyscallStat sum;
+    SyscallStat* stat;
+    u32 nr;
+    u32 hart;
+
+    printf("strace_print_stats: %-22s %10s %14s %10s %10s\n", "syscall", "calls", "total", "avg", "max");
+
+    for (nr = 0; nr <= STRACE_UNKNOWN; nr++) {
+        sum.count = 0;
+        sum.total = 0;
+        sum.max = 0;
+
+        for (hart = 0; hart < NUM_HARTS; hart++) {
+            stat = &strace_buffers[hart].stats[nr];
+
+            sum.count += stat->count;
+            sum.total += stat->total;
+            if (stat->max > sum.max) {
+                sum.max = stat->max;
+            }
+        }
+
+        if (sum.count == 0) {
+            continue;
+        }
+
+        printf(
+            "strace_print_stats: %-22s %10ld %14ld %10ld %10ld\n",
+            _strace_syscall_name(nr),
+            sum.count,
+            sum.total,
+            sum.total / sum.count,
+            sum.max
+        );
+    }
+}
@@ -9,54 +9,244 @@
 #include <page_alloc.h>
 #include <input.h>
 #include <printf.h>
+#include <hartlocal.h>
+#include <rcu.h>
+#include <futex.h>
+#include <ring.h>
+#include <vfs.h>
+#include <kmalloc.h>
+#include <strace.h>
+
+
+// User memory is reached through the process's own mappings (we never leave
+// its satp in a trap), so just check every page is the user's and set SUM.
+bool _user_range_ok(ResourceControlBlock* rcb, uint64_t vaddr, size_t n, uint8_t bits) {
+    uint64_t page;
+    uint8_t flags;
+
+    if (vaddr + n < vaddr) {
+        return false;
+    }
+
+    for (page = vaddr & ~(PS_4K - 1UL); page < vaddr + n; page += PS_4K) {
+        flags = mmu_flags(rcb->ptable, page);
+        if ((flags & (PB_VALID | PB_USER | bits)) != (PB_VALID | PB_USER | bits)) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+bool copy_to_user(void* dst, void* src, size_t n, ResourceControlBlock* rcb) {
+    if (!_user_range_ok(rcb, (uint64_t) dst, n, PB_WRITE)) {
+        printf("copy_to_user: bad user address: 0x%lx\n", (uint64_t) dst);
+        return false;
+    }
+
+    asm volatile("csrs sstatus, %0" :: "r"(SSTATUS_SUM) : "memory");
+    memcpy(dst, src, n);
+    asm volatile("csrc sstatus, %0" :: "r"(SSTATUS_SUM) : "memory");
+
+    return true;
+}
+
+bool copy_from_user(void* dst, void* src, size_t n, ResourceControlBlock* rcb) {
+    if (!_user_range_ok(rcb, (uint64_t) src, n, PB_READ)) {
+        printf("copy_from_user: bad user address: 0x%lx\n", (uint64_t) src);
+        return false;
+    }
 
+    asm volatile("csrs sstatus, %0" :: "r"(SSTATUS_SUM) : "memory");
+    memcpy(dst, src, n);
+    asm volatile("csrc sstatus, %0" :: "r"(SSTATUS_SUM) : "memory");
+
+    return true;
+}
 
-void copy_to_user(void* dst, void* src, size_t n, Process* p) {
-    size_t num_copied;
-    size_t num_to_copy;
-    uint64_t pdst;
-    uint64_t pdst_aligned;
 
-    num_copied = 0;
-    while (num_copied < n) {
-        pdst = mmu_translate(p->rcb.ptable, (uint64_t) dst + num_copied);
-        pdst_aligned = (pdst + PS_4K) & (PS_4K - 1UL);
+// Copies a NUL terminated string of at most max - 1 characters.
+// Returns false if it runs off valid memory or doesn't fit.
+bool _copy_string_from_user(char* dst, uint64_t src, size_t max, ResourceControlBlock* rcb) {
+    size_t i;
 
-        num_to_copy = n - num_copied;
-        if (num_to_copy > pdst_aligned - pdst) {
-            num_to_copy = pdst_aligned - pdst;
+    for (i = 0; i < max; i++) {
+        // Check each page as we get to it, the string could end before the next one
+        if ((i == 0 || (src + i) % PS_4K == 0) && !_user_range_ok(rcb, src + i, 1, PB_READ)) {
+            printf("_copy_string_from_user: bad user address: 0x%lx\n", src + i);
+            return false;
         }
 
-        memcpy((void*) pdst, src + num_copied, num_to_copy);
+        asm volatile("csrs sstatus, %0" :: "r"(SSTATUS_SUM) : "memory");
+        dst[i] = ((char*) src)[i];
+        asm volatile("csrc sstatus, %0" :: "r"(SSTATUS_SUM) : "memory");
 
-        num_copied += num_to_copy;
+        if (dst[i] == '\0') {
+            return true;
+        }
     }
+
+    printf("_copy_string_from_user: string too long\n");
+    return false;
 }
 
-void copy_from_user(void* dst, void* src, size_t n, Process* p) {
-    size_t num_copied;
-    size_t num_to_copy;
-    uint64_t psrc;
-    uint64_t psrc_aligned;
+// Takes a reference the caller drops with vfs_close
+OpenFile* _syscall_get_file(ResourceControlBlock* rcb, int fd) {
+    ListNode* it;
+    FileDescriptor* desc;
 
-    num_copied = 0;
-    while (num_copied < n) {
-        psrc = mmu_translate(p->rcb.ptable, (uint64_t) src + num_copied);
-        psrc_aligned = (psrc + PS_4K) & (PS_4K - 1UL);
+    mutex_sbi_lock(&rcb->lock);
 
-        num_to_copy = n - num_copied;
-        if (num_to_copy > psrc_aligned - psrc) {
-            num_to_copy = psrc_aligned - psrc;
+    for (it = rcb->file_descriptors->head; it != NULL; it = it->next) {
+        desc = it->data;
+        if (desc->fd == fd) {
+            vfs_file_get(desc->file);
+            mutex_unlock(&rcb->lock);
+            return desc->file;
         }
+    }
+
+    mutex_unlock(&rcb->lock);
+    return NULL;
+}
 
-        memcpy(dst + num_copied, (void*) psrc, num_to_copy);
+int syscall_open(ResourceControlBlock* rcb, uint64_t user_path, int flags) {
+    char* path;
+    OpenFile* file;
+    FileDescriptor* desc;
 
-        num_copied += num_to_copy;
+    if (flags != O_RDONLY) {
+        printf("syscall_open: only reading is supported\n");
+        return -1;
     }
+
+    path = hartlocal_scratch_push(SYSCALL_PATH_MAX);
+    if (!_copy_string_from_user(path, user_path, SYSCALL_PATH_MAX, rcb)) {
+        hartlocal_scratch_pop(path);
+        return -1;
+    }
+
+    file = vfs_open(path, flags);
+    hartlocal_scratch_pop(path);
+    if (file == NULL) {
+        return -1;
+    }
+
+    desc = kmalloc(sizeof(FileDescriptor));
+    desc->file = file;
+
+    mutex_sbi_lock(&rcb->lock);
+    desc->fd = rcb->next_fd++;
+    list_insert(rcb->file_descriptors, desc);
+    mutex_unlock(&rcb->lock);
+
+    return desc->fd;
 }
 
+int syscall_close(ResourceControlBlock* rcb, int fd) {
+    ListNode* it;
+    FileDescriptor* desc;
+
+    mutex_sbi_lock(&rcb->lock);
+
+    for (it = rcb->file_descriptors->head; it != NULL; it = it->next) {
+        desc = it->data;
+        if (desc->fd == fd) {
+            list_remove(rcb->file_descriptors, desc);
+            mutex_unlock(&rcb->lock);
+
+            vfs_close(desc->file);
+            kfree(desc);
+            return 0;
+        }
+    }
+
+    mutex_unlock(&rcb->lock);
+    return -1;
+}
+
+// Reads through a kernel buffer a chunk at a time, so a big read doesn't need a big allocation
+int64_t syscall_read(ResourceControlBlock* rcb, int fd, uint64_t user_buf, size_t count) {
+    OpenFile* file;
+    void* chunk;
+    size_t chunk_size;
+    size_t num_read;
+    size_t total_read;
+
+    file = _syscall_get_file(rcb, fd);
+    if (file == NULL) {
+        return -1;
+    }
+
+    if (!_user_range_ok(rcb, user_buf, count, PB_WRITE)) {
+        printf("syscall_read: bad user address: 0x%lx\n", user_buf);
+        vfs_close(file);
+        return -1;
+    }
+
+    chunk_size = count < SYSCALL_READ_CHUNK ? count : SYSCALL_READ_CHUNK;
+    chunk = kmalloc(chunk_size);
+
+    // The position is held for the whole read, so reads from other threads don't interleave
+    mutex_sbi_lock(&file->lock);
+
+    num_read = 0;
+    total_read = 0;
+    while (total_read < count) {
+        num_read = vfs_read_at(file, chunk, count - total_read < chunk_size ? count - total_read : chunk_size, file->position);
+        if (num_read == -1UL) {
+            break;
+        }
+
+        copy_to_user((void*) (user_buf + total_read), chunk, num_read, rcb);
+
+        file->position += num_read;
+        total_read += num_read;
+
+        if (num_read < chunk_size) {
+            break;
+        }
+    }
+
+    mutex_unlock(&file->lock);
+
+    kfree(chunk);
+    vfs_close(file);
 
-unsigned int syscall_get_events(VirtioInputEvent event_buffer[], unsigned int max_events, Process* p) {
+    return num_read == -1UL && total_read == 0 ? -1 : (int64_t) total_read;
+}
+
+int64_t syscall_seek(ResourceControlBlock* rcb, int fd, int64_t offset, int whence) {
+    OpenFile* file;
+    uint64_t position;
+
+    file = _syscall_get_file(rcb, fd);
+    if (file == NULL) {
+        return -1;
+    }
+
+    position = vfs_seek(file, offset, whence);
+    vfs_close(file);
+
+    return position;
+}
+
+int syscall_stat(ResourceControlBlock* rcb, int fd, uint64_t user_stat) {
+    OpenFile* file;
+    VfsStat stat;
+
+    file = _syscall_get_file(rcb, fd);
+    if (file == NULL) {
+        return -1;
+    }
+
+    vfs_stat(file, &stat);
+    vfs_close(file);
+
+    return copy_to_user((void*) user_stat, &stat, sizeof(VfsStat), rcb) ? 0 : -1;
+}
+
+unsigned int syscall_get_events(VirtioInputEvent event_buffer[], unsigned int max_events, ResourceControlBlock* rcb) {
     unsigned int num_events;
     VirtioInputEvent event;
 
@@ -76,7 +266,7 @@ unsigned int syscall_get_events(VirtioInputEvent event_buffer[], unsigned int ma
             break;
         }
 
-        copy_to_user(event_buffer + num_events, &event, sizeof(VirtioInputEvent), p);
+        copy_to_user(event_buffer + num_events, &event, sizeof(VirtioInputEvent), rcb);
 
         num_events++;
         if (num_events == max_events) {
@@ -92,7 +282,7 @@ void syscall_handle(Process* process) {
     uint64_t a0;
     uint64_t a1;
     uint64_t a2;
-    // uint64_t a3;
+    uint64_t a3;
     // uint64_t a4;
     // uint64_t a5;
     // uint64_t a6;
@@ -100,26 +290,40 @@ void syscall_handle(Process* process) {
     uint64_t* rv;
 
     int hart;
+    uint64_t args[4];
+    uint64_t start;
+    uint16_t pid;
+    bool traced;
 
     a0 = process->frame.gpregs[XREG_A0];
     a1 = process->frame.gpregs[XREG_A1];
     a2 = process->frame.gpregs[XREG_A2];
-    // a3 = process->frame.gpregs[XREG_A3];
+    a3 = process->frame.gpregs[XREG_A3];
     // a4 = process->frame.gpregs[XREG_A4];
     // a5 = process->frame.gpregs[XREG_A5];
     // a6 = process->frame.gpregs[XREG_A6];
     a7 = process->frame.gpregs[XREG_A7];
     rv = process->frame.gpregs + XREG_A0;
 
-    hart = sbi_whoami();
+    hart = hartlocal_whoami();
+
+    // Copied out now since exit can free the process before we're done with them
+    args[0] = a0;
+    args[1] = a1;
+    args[2] = a2;
+    args[3] = a3;
+    pid = process->pid;
+    traced = strace_enabled(process->tgid);
+    start = sbi_get_time();
 
     switch (a7) {
         case SYS_EXIT: ;
             process->state = PS_DEAD;
             schedule_park(hart);
             schedule_remove(process);
-            
-            process_free(process);
+
+            // Other harts may still hold a pointer to it, so free it after a grace period.
+            call_rcu((void (*)(void*)) process_free, process);
 
             schedule_schedule(hart);
             break;
@@ -128,15 +332,12 @@ void syscall_handle(Process* process) {
             sbi_putchar((char) a0);
             break;
         
-        case SYS_SLEEP: ;
-            unsigned long current_time;
-            
-            current_time = sbi_get_time();
-
-            process->state = PS_SLEEPING;
-            process->sleep_until = current_time + a0;
+        case SYS_YIELD:
+            schedule_yield(hart);
+            break;
 
-            schedule_schedule(hart);
+        case SYS_SLEEP:
+            schedule_sleep(hart, process, a0);
             break;
 
         case SYS_GPU_GET_DISPLAY_INFO: ;
@@ -152,7 +353,7 @@ void syscall_handle(Process* process) {
                 (void*) a1,
                 &gpu_dev_info->displays[a0].rect,
                 sizeof(VirtioGpuRectangle),
-                process
+                process->rcb
             );
 
             *rv = 0;
@@ -162,8 +363,8 @@ void syscall_handle(Process* process) {
             VirtioGpuRectangle fill_rect;
             VirtioGpuPixel pixel;
 
-            copy_from_user(&fill_rect, (void*) a1, sizeof(VirtioGpuRectangle), process);
-            copy_from_user(&pixel, (void*) a2, sizeof(VirtioGpuPixel), process);
+            copy_from_user(&fill_rect, (void*) a1, sizeof(VirtioGpuRectangle), process->rcb);
+            copy_from_user(&pixel, (void*) a2, sizeof(VirtioGpuPixel), process->rcb);
 
             *rv = (int) !gpu_fill(a0, fill_rect, pixel);
             break;
@@ -171,16 +372,92 @@ void syscall_handle(Process* process) {
         case SYS_GPU_FLUSH: ;
             VirtioGpuRectangle flush_rect;
 
-            copy_from_user(&flush_rect, (void*) a1, sizeof(VirtioGpuRectangle), process);
+            copy_from_user(&flush_rect, (void*) a1, sizeof(VirtioGpuRectangle), process->rcb);
 
             *rv = (int) !gpu_flush(a0, flush_rect);
             break;
         
+        case SYS_SET_PRIORITY:
+            // a0: nice, for the calling process
+            *rv = schedule_set_nice(process, (int) a0) ? 0 : -1;
+            break;
+
+        case SYS_SET_AFFINITY:
+            // a0: mask of harts the calling process may run on
+            *rv = schedule_set_affinity(process, a0) ? 0 : -1;
+            break;
+
+        case SYS_SET_SCHEDULER:
+            // a0: policy, a1: real-time priority, a2: runtime, a3: period
+            *rv = schedule_set_scheduler(process, (int) a0, (int) a1, a2, a3) ? 0 : -1;
+            break;
+
+        case SYS_FUTEX_WAIT:
+            // a0: address, a1: expected value, a2: timeout in ticks, 0 for none
+            futex_wait(hart, process, a0, (uint32_t) a1, a2);
+            break;
+
+        case SYS_FUTEX_WAKE:
+            // a0: address, a1: max number to wake
+            *rv = futex_wake(process, a0, a1);
+            break;
+
+        case SYS_CLONE: ;
+            // a0: entry, a1 and a2: the new thread's a0 and a1
+            Process* thread;
+
+            thread = process_clone(process, a0, a1, a2);
+            if (thread == NULL) {
+                *rv = -1;
+                break;
+            }
+
+            *rv = thread->pid;
+            schedule_add(thread);
+            break;
+
+        case SYS_OPEN:
+            // a0: path, a1: flags
+            *rv = syscall_open(process->rcb, a0, (int) a1);
+            break;
+
+        case SYS_CLOSE:
+            // a0: fd
+            *rv = syscall_close(process->rcb, (int) a0);
+            break;
+
+        case SYS_READ:
+            // a0: fd, a1: buffer, a2: max bytes. Reads from the fd's position and moves it.
+            *rv = syscall_read(process->rcb, (int) a0, a1, a2);
+            break;
+
+        case SYS_SEEK:
+            // a0: fd, a1: offset, a2: VFS_SEEK_*
+            *rv = syscall_seek(process->rcb, (int) a0, (int64_t) a1, (int) a2);
+            break;
+
+        case SYS_STAT:
+            // a0: fd, a1: VfsStat to fill in
+            *rv = syscall_stat(process->rcb, (int) a0, a1);
+            break;
+
+        case SYS_RING_SETUP:
+            // Returns where the rings are mapped, or 0
+            *rv = ring_setup(process);
+            break;
+
+        case SYS_RING_ENTER:
+            // a0: RING_ENTER_* flags
+            *rv = ring_enter(process, a0);
+            break;
+
         case SYS_OLD_GET_EVENTS: ;
-            *rv = syscall_get_events((VirtioInputEvent*) a0, a1, process);
+            *rv = syscall_get_events((VirtioInputEvent*) a0, a1, process->rcb);
             break;
 
         default:
             printf("syscall_handle: unsupported syscall code: %d\n", a7);
     }
+
+    strace_syscall(hart, pid, traced, a7, args, a7 == SYS_EXIT ? 0 : *rv, start, sbi_get_time());
 }
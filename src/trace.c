@@ -0,0 +1,168 @@
+// trace.c
+// Per-hart scheduler event rings and latency histograms.
+// Everything is recorded into the calling hart's buffer, so there's
+// exactly one writer per buffer and no locking.
+
+
+#include <trace.h>
+#include <hartlocal.h>
+#include <sbi.h>
+#include <printf.h>
+#include <rs_int.h>
+
+
+TraceBuffer trace_buffers[NUM_HARTS];
+
+
+TraceBuffer* _trace_get_buffer() {
+    HartLocal* hl;
+
+    HARTLOCAL_GET(hl);
+
+    return &trace_buffers[hl->hart];
+}
+
+void trace_event(TraceEventType type, int hart, uint16_t pid, uint16_t arg) {
+    TraceBuffer* buffer;
+    TraceEvent* event;
+    u64 head;
+
+    buffer = _trace_get_buffer();
+    head = buffer->head;
+
+    event = &buffer->ring[head & (TRACE_RING_SIZE - 1)];
+    event->time = sbi_get_time();
+    event->pid = pid;
+    event->arg = arg;
+    event->type = type;
+    event->hart = hart;
+
+    // Publish the entry before the new head
+    asm volatile("fence w, w" ::: "memory");
+    buffer->head = head + 1;
+}
+
+void _trace_histogram_add(TraceHistogram* hist, u64 ticks) {
+    u32 bucket;
+
+    bucket = 0;
+    while (bucket < TRACE_HIST_BUCKETS - 1 && (ticks >> (bucket + 1)) != 0) {
+        bucket++;
+    }
+
+    hist->buckets[bucket]++;
+    hist->count++;
+    hist->total += ticks;
+    if (ticks > hist->max) {
+        hist->max = ticks;
+    }
+}
+
+void trace_wait(uint64_t ticks) {
+    _trace_histogram_add(&_trace_get_buffer()->wait_hist, ticks);
+}
+
+void trace_wakeup_latency(uint64_t ticks) {
+    _trace_histogram_add(&_trace_get_buffer()->wakeup_hist, ticks);
+}
+
+
+char* _trace_event_type_to_string(u8 type) {
+    switch (type) {
+        case TE_SWITCH:
+            return "switch";
+
+        case TE_WAKEUP:
+            return "wakeup";
+
+        case TE_SLEEP:
+            return "sleep";
+
+        case TE_MIGRATE:
+            return "migrate";
+
+        default:
+            return "unknown";
+    }
+}
+
+// For readers of single-writer rings like ours, after copying entry i out of
+// a ring of size entries. Once head reaches i + size the writer may already be
+// filling i's slot, since it only publishes head after writing.
+bool trace_ring_lapped(volatile uint64_t* head, uint64_t i, uint64_t size) {
+    asm volatile("fence r, r" ::: "memory");
+    return *head - i >= size;
+}
+
+void trace_print() {
+    TraceBuffer* buffer;
+    TraceEvent event;
+    u64 head;
+    u64 start;
+    u64 i;
+    u32 hart;
+
+    for (hart = 0; hart < NUM_HARTS; hart++) {
+        buffer = &trace_buffers[hart];
+
+        head = buffer->head;
+        asm volatile("fence r, r" ::: "memory");
+
+        start = head > TRACE_RING_SIZE ? head - TRACE_RING_SIZE : 0;
+
+        printf("trace_print: recorded on hart %d: %ld events\n", hart, head);
+
+        for (i = start; i < head; i++) {
+            event = buffer->ring[i & (TRACE_RING_SIZE - 1)];
+
+            // The writer lapped us while we were reading this one
+            if (trace_ring_lapped(&buffer->head, i, TRACE_RING_SIZE)) {
+                continue;
+            }
+
+            printf(
+                "trace_print: %ld: %s: hart: %d, pid: %d, arg: %d\n",
+                event.time,
+                _trace_event_type_to_string(event.type),
+                event.hart,
+                event.pid,
+                event.arg
+            );
+        }
+    }
+}
+
+void _trace_histogram_print(char* name, TraceHistogram* hist) {
+    u32 i;
+
+    if (hist->count == 0) {
+        return;
+    }
+
+    printf(
+        "trace_print_histograms: %s: count: %ld, avg: %ld, max: %ld ticks\n",
+        name,
+        hist->count,
+        hist->total / hist->count,
+        hist->max
+    );
+
+    for (i = 0; i < TRACE_HIST_BUCKETS; i++) {
+        if (hist->buckets[i] == 0) {
+            continue;
+        }
+
+        printf("trace_print_histograms:     [%10ld, %10ld): %ld\n", i == 0 ? 0 : 1UL << i, 1UL << (i + 1), hist->buckets[i]);
+    }
+}
+
+void trace_print_histograms() {
+    u32 hart;
+
+    for (hart = 0; hart < NUM_HARTS; hart++) {
+        printf("trace_print_histograms: hart %d\n", hart);
+
+        _trace_histogram_print("run queue wait", &trace_buffers[hart].wait_hist);
+        _trace_histogram_print("wakeup latency", &trace_buffers[hart].wakeup_hist);
+    }
+}
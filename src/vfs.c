@@ -5,9 +5,14 @@
 #include <minix3.h>
 #include <ext4.h>
 #include <printf.h>
+#include <hartlocal.h>
+#include <rcu.h>
+#include <lock.h>
+#include <rs_int.h>
 
 
 VfsCacheNode* vfs_cnode_cache;
+Mutex vfs_lock;
 
 
 bool vfs_init() {
@@ -45,12 +50,20 @@ VfsCacheNode* _vfs_get_cnode(char* path, bool create, char* path_left) {
     list_remove(path_names, name);
     kfree(name);
 
+    // Lookups walk the tree lock-free, only mounting takes the lock.
+    // Cache nodes are never freed while mounted, so the returned cnode stays valid.
+    if (create) {
+        mutex_sbi_lock(&vfs_lock);
+    } else {
+        rcu_read_lock();
+    }
+
     current_cnode = vfs_cnode_cache;
     for (name_it = path_names->head; name_it != NULL; name_it = name_it->next) {
         found_flag = false;
         name = name_it->data;
 
-        for (cnode_it = current_cnode->children->head; cnode_it != NULL; cnode_it = cnode_it->next) {
+        for (cnode_it = RCU_DEREFERENCE(current_cnode->children->head); cnode_it != NULL; cnode_it = RCU_DEREFERENCE(cnode_it->next)) {
             tmp_cnode = cnode_it->data;
             if (strcmp(tmp_cnode->name, name) == 0) {
                 current_cnode = tmp_cnode;
@@ -66,7 +79,7 @@ VfsCacheNode* _vfs_get_cnode(char* path, bool create, char* path_left) {
                 tmp_cnode->name = kzalloc(strlen(name) + 1);
                 memcpy(tmp_cnode->name, name, strlen(name));
 
-                list_insert(current_cnode->children, tmp_cnode);
+                list_insert_rcu(current_cnode->children, tmp_cnode);
                 current_cnode = tmp_cnode;
             } else {
                 sub_path_names = list_new();
@@ -83,11 +96,18 @@ VfsCacheNode* _vfs_get_cnode(char* path, bool create, char* path_left) {
                 sub_path_names->last = NULL;
                 kfree(sub_path_names);
 
+                rcu_read_unlock();
                 return current_cnode;
             }
         }
     }
 
+    if (create) {
+        mutex_unlock(&vfs_lock);
+    } else {
+        rcu_read_unlock();
+    }
+
     list_free_data(path_names);
     list_free(path_names);
 
@@ -108,19 +128,20 @@ VfsCacheNode* vfs_mount(VirtioDevice* block_device, char* path) {
         return NULL;
     }
 
+    cnode->block_device = block_device;
+
+    // Set type last so lock-free lookups never see a half-mounted cnode
     if (minix3_init(block_device)) {
-        cnode->type = NT_MINIX3;
         cnode->node = minix3_get_file(block_device, "/");
+        RCU_ASSIGN_POINTER(cnode->type, NT_MINIX3);
     } else if (ext4_init(block_device)) {
-        cnode->type = NT_EXT4;
         cnode->node = ext4_get_file(block_device, "/");
+        RCU_ASSIGN_POINTER(cnode->type, NT_EXT4);
     } else {
         printf("vfs_mount: failed to init filesystem\n");
         return NULL;
     }
 
-    cnode->block_device = block_device;
-
     return cnode;
 }
 
@@ -133,11 +154,11 @@ size_t vfs_read_file(char* path, void* buf, size_t count) {
     char* path_left;
     size_t num_read;
 
-    path_left = kzalloc(strlen(path) + 2);
+    path_left = hartlocal_scratch_push(strlen(path) + 2);
     path_left[0] = '/';
     cnode = vfs_get_mount(path, path_left + 1);
     if (cnode == NULL) {
-        kfree(path_left);
+        hartlocal_scratch_pop(path_left);
         return -1UL;
     }
 
@@ -156,7 +177,7 @@ size_t vfs_read_file(char* path, void* buf, size_t count) {
             break;
     }
 
-    kfree(path_left);
+    hartlocal_scratch_pop(path_left);
     return num_read;
 }
 
@@ -165,11 +186,11 @@ size_t vfs_get_filesize(char* path) {
     char* path_left;
     size_t size;
 
-    path_left = kzalloc(strlen(path) + 2);
+    path_left = hartlocal_scratch_push(strlen(path) + 2);
     path_left[0] = '/';
     cnode = vfs_get_mount(path, path_left + 1);
     if (cnode == NULL) {
-        kfree(path_left);
+        hartlocal_scratch_pop(path_left);
         return -1UL;
     }
 
@@ -188,6 +209,153 @@ size_t vfs_get_filesize(char* path) {
             break;
     }
 
-    kfree(path_left);
+    hartlocal_scratch_pop(path_left);
     return size;
 }
+
+
+OpenFile* vfs_open(char* path, int flags) {
+    VfsCacheNode* cnode;
+    OpenFile* file;
+    Minix3CacheNode* minix3_node;
+    Ext4CacheNode* ext4_node;
+    char* path_left;
+
+    path_left = hartlocal_scratch_push(strlen(path) + 2);
+    memset(path_left, 0, strlen(path) + 2);
+    path_left[0] = '/';
+    cnode = vfs_get_mount(path, path_left + 1);
+    if (cnode == NULL) {
+        hartlocal_scratch_pop(path_left);
+        return NULL;
+    }
+
+    file = kzalloc(sizeof(OpenFile));
+    file->mount = cnode;
+    file->flags = flags;
+    file->lock = MUTEX_UNLOCKED;
+    file->refs = 1;
+
+    switch (cnode->type) {
+        case NT_MINIX3:
+            minix3_node = minix3_get_file(cnode->block_device, path_left);
+            if (minix3_node != NULL) {
+                file->node = minix3_node;
+                file->size = minix3_node->inode.size;
+                file->mode = minix3_node->inode.mode;
+            }
+
+            break;
+
+        case NT_EXT4:
+            ext4_node = ext4_get_file(cnode->block_device, path_left);
+            if (ext4_node != NULL) {
+                file->node = ext4_node;
+                file->size = EXT4_COMBINE_VAL32(ext4_node->inode.i_size_high, ext4_node->inode.i_size);
+                file->mode = ext4_node->inode.i_mode;
+            }
+
+            break;
+
+        default:
+            printf("vfs_open: unsupported type: %d\n", cnode->type);
+            break;
+    }
+
+    hartlocal_scratch_pop(path_left);
+
+    if (file->node == NULL) {
+        kfree(file);
+        return NULL;
+    }
+
+    return file;
+}
+
+// Doesn't touch the position, so it's fine to call on a file other threads are reading
+size_t vfs_read_at(OpenFile* file, void* buf, size_t count, uint64_t offset) {
+    switch (file->mount->type) {
+        case NT_MINIX3:
+            return minix3_read_at(file->mount->block_device, file->node, buf, count, offset);
+
+        case NT_EXT4:
+            return ext4_read_at(file->mount->block_device, file->node, buf, count, offset);
+
+        default:
+            printf("vfs_read_at: unsupported type: %d\n", file->mount->type);
+            return -1UL;
+    }
+}
+
+size_t vfs_read(OpenFile* file, void* buf, size_t count) {
+    size_t num_read;
+
+    mutex_sbi_lock(&file->lock);
+
+    num_read = vfs_read_at(file, buf, count, file->position);
+    if (num_read != -1UL) {
+        file->position += num_read;
+    }
+
+    mutex_unlock(&file->lock);
+
+    return num_read;
+}
+
+// Returns the new position, or -1UL if it would've been negative
+uint64_t vfs_seek(OpenFile* file, int64_t offset, int whence) {
+    int64_t base;
+
+    mutex_sbi_lock(&file->lock);
+
+    switch (whence) {
+        case VFS_SEEK_SET:
+            base = 0;
+            break;
+
+        case VFS_SEEK_CUR:
+            base = file->position;
+            break;
+
+        case VFS_SEEK_END:
+            base = file->size;
+            break;
+
+        default:
+            mutex_unlock(&file->lock);
+            printf("vfs_seek: invalid whence: %d\n", whence);
+            return -1UL;
+    }
+
+    if (base + offset < 0) {
+        mutex_unlock(&file->lock);
+        return -1UL;
+    }
+
+    file->position = base + offset;
+
+    mutex_unlock(&file->lock);
+
+    return file->position;
+}
+
+void vfs_stat(OpenFile* file, VfsStat* stat) {
+    stat->size = file->size;
+    stat->mode = file->mode;
+    stat->type = file->mount->type;
+}
+
+// For holding on to it across a read that a close could otherwise pull out from under
+void vfs_file_get(OpenFile* file) {
+    asm volatile("amoadd.w zero, %0, (%1)" :: "r"(1), "r"(&file->refs) : "memory");
+}
+
+// Drops a reference. Cache nodes live as long as the mount, so the last one only frees the OpenFile.
+void vfs_close(OpenFile* file) {
+    u32 refs;
+
+    asm volatile("amoadd.w %0, %1, (%2)" : "=r"(refs) : "r"(-1), "r"(&file->refs) : "memory");
+    if (refs == 1) {
+        kfree(file);
+    }
+}
@@ -8,23 +8,32 @@
 #include <input.h>
 #include <printf.h>
 #include <rs_int.h>
+#include <rcu.h>
 
 
 VirtioDeviceList* device_head;
+Mutex device_list_lock;
 
 
 void virtio_handle_irq(uint32_t irq) {
     VirtioDeviceList* it;
     VirtioDevice* device;
 
-    for (it = device_head; it != NULL; it = it->next) {
+    // Dispatch without a lock, devices are only ever unlinked through rcu
+    rcu_read_lock();
+
+    for (it = RCU_DEREFERENCE(device_head); it != NULL; it = RCU_DEREFERENCE(it->next)) {
         device = it->device;
         if (irq == device->irq && (*device->isr & (VIRTIO_ISR_QUEUE_INT | VIRTIO_ISR_DEVICE_CFG_INT))) {
             device->handle_irq(device);
+
+            rcu_read_unlock();
             return;
         }
     }
 
+    rcu_read_unlock();
+
     printf("virtio_handle_irq: could not find interrupting device with irq: %d\n", irq);
     return;
 }
@@ -204,6 +213,10 @@ void virtio_add_device(VirtioDevice* device) {
     new_node = kmalloc(sizeof(VirtioDeviceList));
     new_node->device = device;
 
+    mutex_sbi_lock(&device_list_lock);
+
     new_node->next = device_head;
-    device_head = new_node;
+    RCU_ASSIGN_POINTER(device_head, new_node);
+
+    mutex_unlock(&device_list_lock);
 }
@@ -0,0 +1,175 @@
+// workqueue.c
+// Per-hart queues of deferred work, for whatever's too slow to do in a trap.
+// Interrupt handlers acknowledge the device, queue the rest, and get out, and
+// the work runs later in a kernel thread. Like every kernel thread, it runs with
+// interrupts off, so it lets them in between items instead.
+
+
+#include <workqueue.h>
+#include <kthread.h>
+#include <schedule.h>
+#include <csr.h>
+#include <printf.h>
+#include <rs_int.h>
+
+
+WorkQueue work_queues[NUM_HARTS];
+u32 workqueue_next_hart;
+
+
+void _workqueue_worker(void* data) {
+    WorkQueue* wq;
+    Work* work;
+
+    wq = data;
+
+    while (true) {
+        mutex_sbi_lock(&wq->lock);
+
+        work = wq->head;
+        if (work == NULL) {
+            // Whoever queues next wakes us. Interrupts are off, so the only
+            // thing that can get between this and the yield is that wakeup.
+            wq->worker->state = PS_WAITING;
+            mutex_unlock(&wq->lock);
+
+            kthread_yield();
+            continue;
+        }
+
+        wq->head = work->next;
+        if (wq->head == NULL) {
+            wq->tail = NULL;
+        }
+
+        // Cleared first so func can queue it again. func may also free it.
+        work->pending = false;
+
+        mutex_unlock(&wq->lock);
+
+        work->func(work->data);
+        wq->stats.run++;
+
+        // A long queue shouldn't hold off interrupts or whoever's waiting for this hart
+        kthread_preempt_point();
+    }
+}
+
+bool workqueue_init() {
+    WorkQueue* wq;
+    u32 i;
+
+    for (i = 0; i < NUM_HARTS; i++) {
+        work_queues[i].lock = MUTEX_UNLOCKED;
+    }
+
+    workqueue_next_hart = 0;
+
+    // Hart 0 never runs processes, so it gets no worker
+    for (i = SCHEDULE_FIRST_HART; i < NUM_HARTS; i++) {
+        wq = &work_queues[i];
+
+        wq->worker = kthread_new(_workqueue_worker, wq);
+        if (wq->worker == NULL) {
+            printf("workqueue_init: kthread_new failed for hart %d\n", i);
+            return false;
+        }
+
+        // Completion work shouldn't sit behind a pile of user processes
+        schedule_set_nice(wq->worker, PROCESS_NICE_MIN);
+        schedule_set_affinity(wq->worker, 1UL << i);
+
+        schedule_add(wq->worker);
+    }
+
+    return true;
+}
+
+void work_prepare(Work* work, void (*func)(void*), void* data) {
+    work->next = NULL;
+    work->func = func;
+    work->data = data;
+    work->pending = false;
+}
+
+// Queues work for hart's worker. Safe from interrupt handlers.
+// Returns false if work was already pending.
+bool workqueue_queue_on(int hart, Work* work) {
+    WorkQueue* wq;
+    u64 sstatus;
+
+    if (!IS_VALID_HART(hart)) {
+        printf("workqueue_queue_on: invalid hart: %d\n", hart);
+        return false;
+    }
+
+    wq = &work_queues[hart];
+
+    // Nothing to defer to yet, like during boot
+    if (wq->worker == NULL) {
+        wq->stats.run_inline++;
+        work->func(work->data);
+        return true;
+    }
+
+    // The worker's lock is also taken from interrupt handlers
+    asm volatile("csrrc %0, sstatus, %1" : "=r"(sstatus) : "r"(SSTATUS_SIE));
+
+    mutex_sbi_lock(&wq->lock);
+
+    if (work->pending) {
+        mutex_unlock(&wq->lock);
+        asm volatile("csrs sstatus, %0" :: "r"(sstatus & SSTATUS_SIE));
+        return false;
+    }
+
+    work->pending = true;
+    work->next = NULL;
+    if (wq->tail == NULL) {
+        wq->head = work;
+    } else {
+        wq->tail->next = work;
+    }
+
+    wq->tail = work;
+    wq->stats.queued++;
+
+    if (wq->worker->state == PS_WAITING) {
+        wq->stats.wakeups++;
+        schedule_wake(wq->worker);
+    }
+
+    mutex_unlock(&wq->lock);
+    asm volatile("csrs sstatus, %0" :: "r"(sstatus & SSTATUS_SIE));
+
+    return true;
+}
+
+// Queues work on the next hart round robin, so completions spread out
+bool workqueue_queue(Work* work) {
+    u32 n;
+
+    asm volatile("amoadd.w %0, %1, (%2)" : "=r"(n) : "r"(1), "r"(&workqueue_next_hart));
+
+    return workqueue_queue_on(SCHEDULE_FIRST_HART + n % (NUM_HARTS - SCHEDULE_FIRST_HART), work);
+}
+
+
+void workqueue_print() {
+    WorkQueue* wq;
+    u32 i;
+
+    for (i = SCHEDULE_FIRST_HART; i < NUM_HARTS; i++) {
+        wq = &work_queues[i];
+
+        printf(
+            "workqueue_print: hart: %d, worker pid: %d, queued: %ld, run: %ld, inline: %ld, wakeups: %ld\n",
+            i,
+            wq->worker == NULL ? 0 : wq->worker->pid,
+            wq->stats.queued,
+            wq->stats.run,
+            wq->stats.run_inline,
+            wq->stats.wakeups
+        );
+    }
+}
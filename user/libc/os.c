@@ -18,6 +18,14 @@ enum SYSCALL_NOS {
     SYS_GPU_GET_DISPLAY_INFO,
     SYS_GPU_FILL,
     SYS_GPU_FLUSH,
+    SYS_SET_PRIORITY,
+    SYS_SET_AFFINITY,
+    SYS_SET_SCHEDULER,
+    SYS_FUTEX_WAIT,
+    SYS_FUTEX_WAKE,
+    SYS_CLONE,
+    SYS_RING_SETUP,
+    SYS_RING_ENTER,
 };
 
 
@@ -25,6 +33,53 @@ void yield(void) {
     asm volatile("mv a7, %0\necall" : : "r"(SYS_YIELD) : "a7");
 }
 
+int setpriority(int nice) {
+    int rv;
+    asm volatile("mv a7, %1\nmv a0, %2\necall\nmv %0, a0" : "=r"(rv) : "r"(SYS_SET_PRIORITY), "r"(nice) : "a0", "a7");
+    return rv;
+}
+
+int set_affinity(unsigned long mask) {
+    int rv;
+    asm volatile("mv a7, %1\nmv a0, %2\necall\nmv %0, a0" : "=r"(rv) : "r"(SYS_SET_AFFINITY), "r"(mask) : "a0", "a7");
+    return rv;
+}
+
+int set_scheduler(int policy, int priority, unsigned long runtime, unsigned long period) {
+    int rv;
+    asm volatile("mv a7, %1\nmv a0, %2\nmv a1, %3\nmv a2, %4\nmv a3, %5\necall\nmv %0, a0" : "=r"(rv) : "r"(SYS_SET_SCHEDULER), "r"(policy), "r"(priority), "r"(runtime), "r"(period) : "a0", "a1", "a2", "a3", "a7");
+    return rv;
+}
+
+int futex_wait(int *addr, int val, unsigned long timeout) {
+    int rv;
+    asm volatile("mv a7, %1\nmv a0, %2\nmv a1, %3\nmv a2, %4\necall\nmv %0, a0" : "=r"(rv) : "r"(SYS_FUTEX_WAIT), "r"(addr), "r"(val), "r"(timeout) : "a0", "a1", "a2", "a7", "memory");
+    return rv;
+}
+
+int futex_wake(int *addr, int n) {
+    int rv;
+    asm volatile("mv a7, %1\nmv a0, %2\nmv a1, %3\necall\nmv %0, a0" : "=r"(rv) : "r"(SYS_FUTEX_WAKE), "r"(addr), "r"(n) : "a0", "a1", "a7", "memory");
+    return rv;
+}
+
+int clone(void (*entry)(void *, void *), void *a0, void *a1) {
+    int tid;
+    asm volatile("mv a7, %1\nmv a0, %2\nmv a1, %3\nmv a2, %4\necall\nmv %0, a0" : "=r"(tid) : "r"(SYS_CLONE), "r"(entry), "r"(a0), "r"(a1) : "a0", "a1", "a2", "a7");
+    return tid;
+}
+
+// New threads start here, so they exit cleanly if func returns
+static void thread_start(void *func, void *arg) {
+    ((void (*)(void *)) func)(arg);
+
+    asm volatile("mv a7, %0\necall" : : "r"(SYS_EXIT) : "a7");
+}
+
+int thread_create(void (*func)(void *), void *arg) {
+    return clone(thread_start, (void *) func, arg);
+}
+
 void sleep(int tm) {
     asm volatile("mv a7, %0\nmv a0, %1\necall" : : "r"(SYS_SLEEP), "r"(tm) : "a0", "a7");
 }
@@ -45,9 +100,21 @@ void close(int fd) {
     asm volatile("mv a7, %0\nmv a0, %1\necall" : : "r"(SYS_CLOSE), "r"(fd) : "a0", "a7");
 }
 
+long seek(int fd, long offset, int whence) {
+    long position;
+    asm volatile("mv a7, %1\nmv a0, %2\nmv a1, %3\nmv a2, %4\necall\nmv %0, a0" : "=r"(position) : "r"(SYS_SEEK), "r"(fd), "r"(offset), "r"(whence) : "a0", "a1", "a2", "a7");
+    return position;
+}
+
+int stat(int fd, Stat *st) {
+    int rv;
+    asm volatile("mv a7, %1\nmv a0, %2\nmv a1, %3\necall\nmv %0, a0" : "=r"(rv) : "r"(SYS_STAT), "r"(fd), "r"(st) : "a0", "a1", "a7", "memory");
+    return rv;
+}
+
 int read(int fd, char *buffer, int max_size) {
     int bytes_read;
-    asm volatile("mv a7, %1\nmv a0, %2\nmv a1, %3\nmv a2, %4\necall\nmv %0, a0" : "=r"(bytes_read) : "r"(SYS_READ), "r"(fd), "r"(buffer), "r"(max_size) : "a0", "a1", "a2", "a7");
+    asm volatile("mv a7, %1\nmv a0, %2\nmv a1, %3\nmv a2, %4\necall\nmv %0, a0" : "=r"(bytes_read) : "r"(SYS_READ), "r"(fd), "r"(buffer), "r"(max_size) : "a0", "a1", "a2", "a7", "memory");
     return bytes_read;
 }
 
@@ -59,10 +126,27 @@ int write(int fd, const char *buffer, int bytes) {
     return bytes_written;
 }
 
+// The info page has display info, so this doesn't need SYS_GPU_GET_DISPLAY_INFO
 int gpu_get_display_info(int scanout_id, VirtioGpuRectangle* rect) {
-    int rv;
-    asm volatile("mv a7, %1\nmv a0, %2\nmv a1, %3\necall\nmv %0, a0" : "=r"(rv) : "r"(SYS_GPU_GET_DISPLAY_INFO), "r"(scanout_id), "r"(rect) : "a0", "a1", "a7");
-    return rv;
+    const OsInfo *info = (const OsInfo *) OSINFO_VADDR;
+    unsigned int seq;
+    unsigned int enabled;
+
+    if (scanout_id < 0 || scanout_id >= OSINFO_MAX_DISPLAYS) {
+        return 1;
+    }
+
+    do {
+        seq = info->seq;
+        asm volatile("fence r, r" ::: "memory");
+
+        *rect = info->displays[scanout_id].rect;
+        enabled = info->displays[scanout_id].enabled;
+
+        asm volatile("fence r, r" ::: "memory");
+    } while ((seq & 1) || info->seq != seq);
+
+    return enabled ? 0 : 1;
 }
 
 int gpu_fill(int scanout_id, VirtioGpuRectangle* fill_rect, VirtioGpuPixel* pixel) {
@@ -76,3 +160,141 @@ int gpu_flush(int scanout_id, VirtioGpuRectangle* flush_rect) {
     asm volatile("mv a7, %1\nmv a0, %2\nmv a1, %3\necall\nmv %0, a0" : "=r"(rv) : "r"(SYS_GPU_FLUSH), "r"(scanout_id), "r"(flush_rect) : "a0", "a1", "a7");
     return rv;
 }
+
+int getpid(void) {
+    return ((const OsProcessInfo *) OSINFO_PROCESS_VADDR)->pid;
+}
+
+int get_nprocs(void) {
+    return ((const OsInfo *) OSINFO_VADDR)->num_harts;
+}
+
+// Reads the time base and scale together, so they're from the same update
+static void clock_read(unsigned long *time_base, unsigned long *hz) {
+    const OsInfo *info = (const OsInfo *) OSINFO_VADDR;
+    unsigned int seq;
+
+    do {
+        seq = info->seq;
+        asm volatile("fence r, r" ::: "memory");
+
+        *time_base = info->time_base;
+        *hz = info->ticks_per_sec;
+
+        asm volatile("fence r, r" ::: "memory");
+    } while ((seq & 1) || info->seq != seq);
+}
+
+// Ticks since boot
+unsigned long gettime(void) {
+    unsigned long time;
+    unsigned long time_base;
+    unsigned long hz;
+
+    clock_read(&time_base, &hz);
+    asm volatile("rdtime %0" : "=r"(time));
+
+    return time - time_base;
+}
+
+unsigned long gettime_ns(void) {
+    unsigned long time;
+    unsigned long time_base;
+    unsigned long hz;
+
+    clock_read(&time_base, &hz);
+    asm volatile("rdtime %0" : "=r"(time));
+    time -= time_base;
+
+    return (time / hz) * 1000000000UL + (time % hz) * 1000000000UL / hz;
+}
+
+unsigned long ticks_per_sec(void) {
+    unsigned long time_base;
+    unsigned long hz;
+
+    clock_read(&time_base, &hz);
+
+    return hz;
+}
+
+
+Ring *ring_setup(void) {
+    unsigned long vaddr;
+    asm volatile("mv a7, %1\necall\nmv %0, a0" : "=r"(vaddr) : "r"(SYS_RING_SETUP) : "a0", "a7");
+    return (Ring *) vaddr;
+}
+
+long ring_enter(unsigned int flags) {
+    long rv;
+    asm volatile("mv a7, %1\nmv a0, %2\necall\nmv %0, a0" : "=r"(rv) : "r"(SYS_RING_ENTER), "r"(flags) : "a0", "a7", "memory");
+    return rv;
+}
+
+// Returns the next free submission slot, or 0 if the queue is full.
+// Nothing is submitted until ring_submit.
+RingSqe *ring_get_sqe(Ring *ring) {
+    RingSqe *sqe;
+
+    if (ring->sq_tail - ring->sq_head >= ring->sq_entries) {
+        return 0;
+    }
+
+    sqe = &ring->sqes[ring->sq_tail & (ring->sq_entries - 1)];
+    sqe->flags = 0;
+    sqe->user_data = 0;
+
+    return sqe;
+}
+
+// Publishes the slot ring_get_sqe gave out
+void ring_submit(Ring *ring) {
+    asm volatile("fence w, w" ::: "memory");
+    ring->sq_tail++;
+}
+
+// Returns the oldest completion, or 0 if there isn't one yet
+RingCqe *ring_peek_cqe(Ring *ring) {
+    RingCqe *cqes = (RingCqe *) ((unsigned long) ring + 4096);
+
+    if (ring->cq_head == ring->cq_tail) {
+        return 0;
+    }
+
+    asm volatile("fence r, r" ::: "memory");
+
+    return &cqes[ring->cq_head & (ring->cq_entries - 1)];
+}
+
+void ring_cqe_seen(Ring *ring) {
+    asm volatile("fence rw, w" ::: "memory");
+    ring->cq_head++;
+}
+
+void ring_prep_gpu_fill(RingSqe *sqe, int scanout_id, VirtioGpuRectangle *rect, VirtioGpuPixel *pixel) {
+    sqe->op = RING_OP_GPU_FILL;
+    sqe->args[0] = scanout_id;
+    sqe->args[1] = rect->x | (unsigned long) rect->y << 32;
+    sqe->args[2] = rect->width | (unsigned long) rect->height << 32;
+    sqe->args[3] = pixel->r | pixel->g << 8 | pixel->b << 16 | (unsigned long) pixel->a << 24;
+}
+
+void ring_prep_gpu_flush(RingSqe *sqe, int scanout_id, VirtioGpuRectangle *rect) {
+    sqe->op = RING_OP_GPU_FLUSH;
+    sqe->args[0] = scanout_id;
+    sqe->args[1] = rect->x | (unsigned long) rect->y << 32;
+    sqe->args[2] = rect->width | (unsigned long) rect->height << 32;
+}
+
+void ring_prep_get_events(RingSqe *sqe, InputEvent *event_buffer, unsigned int max_events) {
+    sqe->op = RING_OP_GET_EVENTS;
+    sqe->args[0] = (unsigned long) event_buffer;
+    sqe->args[1] = max_events;
+}
+
+void ring_prep_read(RingSqe *sqe, int fd, void *buffer, unsigned long max_size) {
+    sqe->op = RING_OP_READ;
+    sqe->args[0] = fd;
+    sqe->args[1] = (unsigned long) buffer;
+    sqe->args[2] = max_size;
+}
@@ -5,17 +5,119 @@
 #include "event.h"
 
 
+// Read-only pages the kernel maps into every process. Same layout as the kernel's osinfo.h.
+#define OSINFO_VADDR            0x200000UL
+#define OSINFO_PROCESS_VADDR    (OSINFO_VADDR + 4096)
+#define OSINFO_MAX_DISPLAYS     16
+
+typedef struct OsInfoDisplay {
+    VirtioGpuRectangle rect;
+    unsigned int enabled;
+} OsInfoDisplay;
+
+typedef struct OsInfo {
+    volatile unsigned int seq;
+    unsigned int num_harts;
+    unsigned long time_base;
+    unsigned long ticks_per_sec;
+    OsInfoDisplay displays[OSINFO_MAX_DISPLAYS];
+} OsInfo;
+
+typedef struct OsProcessInfo {
+    unsigned int pid;
+} OsProcessInfo;
+
+
+// What stat fills in, same layout as the kernel's VfsStat
+typedef struct Stat {
+    unsigned long size;
+    unsigned int mode;
+    unsigned int type;
+} Stat;
+
+
+// Submission/completion rings, same layout as the kernel's ring.h.
+// Completions are in the page after the Ring.
+#define RING_ENTER_ASYNC    (1 << 0)
+
+#define RING_OP_NOP         0
+#define RING_OP_GPU_FILL    1
+#define RING_OP_GPU_FLUSH   2
+#define RING_OP_GET_EVENTS  3
+#define RING_OP_READ        4
+
+typedef struct RingSqe {
+    unsigned int op;
+    unsigned int flags;
+    unsigned long user_data;
+    unsigned long args[4];
+} RingSqe;
+
+typedef struct RingCqe {
+    unsigned long user_data;
+    long result;
+} RingCqe;
+
+typedef struct Ring {
+    volatile unsigned int sq_head;
+    volatile unsigned int sq_tail;
+    volatile unsigned int cq_head;
+    volatile unsigned int cq_tail;
+    unsigned int sq_entries;
+    unsigned int cq_entries;
+    unsigned char reserved[40];
+    RingSqe sqes[];
+} Ring;
+
+
 void sleep(int tm);
 void yield(void);
+int setpriority(int nice);
+int set_affinity(unsigned long mask);
+int set_scheduler(int policy, int priority, unsigned long runtime, unsigned long period);
+int futex_wait(int *addr, int val, unsigned long timeout);
+int futex_wake(int *addr, int n);
+int clone(void (*entry)(void *, void *), void *a0, void *a1);
+int thread_create(void (*func)(void *), void *arg);
 unsigned int get_events(InputEvent event_buffer[], unsigned int max_events);
 int open(const char *path, int flags);
 int read(int fd, char *buffer, int max_size);
 int write(int fd, const char *buffer, int bytes);
 void close(int fd);
+long seek(int fd, long offset, int whence);
+int stat(int fd, Stat *st);
 int gpu_get_display_info(int scanout_id, VirtioGpuRectangle* rect);
+int getpid(void);
+int get_nprocs(void);
+unsigned long gettime(void);
+unsigned long gettime_ns(void);
+unsigned long ticks_per_sec(void);
+Ring *ring_setup(void);
+long ring_enter(unsigned int flags);
+RingSqe *ring_get_sqe(Ring *ring);
+void ring_submit(Ring *ring);
+RingCqe *ring_peek_cqe(Ring *ring);
+void ring_cqe_seen(Ring *ring);
+void ring_prep_gpu_fill(RingSqe *sqe, int scanout_id, VirtioGpuRectangle *rect, VirtioGpuPixel *pixel);
+void ring_prep_gpu_flush(RingSqe *sqe, int scanout_id, VirtioGpuRectangle *rect);
+void ring_prep_get_events(RingSqe *sqe, InputEvent *event_buffer, unsigned int max_events);
+void ring_prep_read(RingSqe *sqe, int fd, void *buffer, unsigned long max_size);
 int gpu_fill(int scanout_id, VirtioGpuRectangle* fill_rect, VirtioGpuPixel* pixel);
 int gpu_flush(int scanout_id, VirtioGpuRectangle* flush_rect);
 
 #define O_RDONLY 0
 #define O_WRONLY 1
 #define O_RDWR   2
+
+#define SEEK_SET 0
+#define SEEK_CUR 1
+#define SEEK_END 2
+
+#define SCHED_NORMAL    0
+#define SCHED_FIFO      1
+#define SCHED_RR        2
+
+// futex_wait return values
+#define FUTEX_WOKEN     0
+#define FUTEX_TIMED_OUT 1
+#define FUTEX_AGAIN     -1
@@ -44,6 +44,59 @@ typedef struct AppState {
 
 State app_state;
 
+// Batches the fills for a stroke into one trap. Null if the kernel wouldn't give us one.
+Ring *app_ring;
+
+
+void app_ring_enter() {
+    if (app_ring == 0) {
+        return;
+    }
+
+    ring_enter(0);
+
+    // Nobody looks at the results, just make room for more
+    while (ring_peek_cqe(app_ring) != 0) {
+        ring_cqe_seen(app_ring);
+    }
+}
+
+void queue_fill(VirtioGpuRectangle *rect, VirtioGpuPixel *pixel) {
+    RingSqe *sqe;
+
+    if (app_ring == 0) {
+        gpu_fill(SCANOUT_ID, rect, pixel);
+        return;
+    }
+
+    sqe = ring_get_sqe(app_ring);
+    if (sqe == 0) {
+        app_ring_enter();
+        sqe = ring_get_sqe(app_ring);
+    }
+
+    ring_prep_gpu_fill(sqe, SCANOUT_ID, rect, pixel);
+    ring_submit(app_ring);
+}
+
+void queue_flush(VirtioGpuRectangle *rect) {
+    RingSqe *sqe;
+
+    if (app_ring == 0) {
+        gpu_flush(SCANOUT_ID, rect);
+        return;
+    }
+
+    sqe = ring_get_sqe(app_ring);
+    if (sqe == 0) {
+        app_ring_enter();
+        sqe = ring_get_sqe(app_ring);
+    }
+
+    ring_prep_gpu_flush(sqe, SCANOUT_ID, rect);
+    ring_submit(app_ring);
+}
+
 
 int app_init() {
     VirtioGpuRectangle screen_rect;
@@ -128,7 +181,7 @@ void draw_line(VirtioGpuRectangle from_rect, VirtioGpuRectangle to_rect, VirtioG
     }
 
     while (from_rect.x != to_rect.x || from_rect.y != to_rect.y) {
-        gpu_fill(SCANOUT_ID, &from_rect, &pixel);
+        queue_fill(&from_rect, &pixel);
 
         rise = to_rect.y - from_rect.y;
         run = to_rect.x - from_rect.x;
@@ -169,8 +222,9 @@ void draw_line(VirtioGpuRectangle from_rect, VirtioGpuRectangle to_rect, VirtioG
         from_rect.x += run;
     }
 
-    gpu_fill(SCANOUT_ID, &to_rect, &pixel);
-    gpu_flush(SCANOUT_ID, &flush_rect);
+    queue_fill(&to_rect, &pixel);
+    queue_flush(&flush_rect);
+    app_ring_enter();
 }
 
 int is_inside_rectangle(uint32_t x, uint32_t y, VirtioGpuRectangle* rect) {
@@ -332,6 +386,13 @@ void app_loop() {
 int main() {
     int rv;
 
+    // Stay responsive while other processes are busy. Falls back
+    // to just a better nice level if there's no real-time bandwidth left.
+    setpriority(-5);
+    set_scheduler(SCHED_RR, 10, 0, 0);
+
+    app_ring = ring_setup();
+
     rv = app_init();
     if (rv != 0) {
         printf("paint: failed to init screen\n");